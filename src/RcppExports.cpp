@@ -6,38 +6,104 @@
 using namespace Rcpp;
 
 // doFindMode
-SEXP doFindMode(SEXP x);
-RcppExport SEXP rasterfaster_doFindMode(SEXP xSEXP) {
+SEXP doFindMode(SEXP x, bool naRm);
+RcppExport SEXP rasterfaster_doFindMode(SEXP xSEXP, SEXP naRmSEXP) {
 BEGIN_RCPP
     Rcpp::RObject __result;
     Rcpp::RNGScope __rngScope;
     Rcpp::traits::input_parameter< SEXP >::type x(xSEXP);
-    __result = Rcpp::wrap(doFindMode(x));
+    Rcpp::traits::input_parameter< bool >::type naRm(naRmSEXP);
+    __result = Rcpp::wrap(doFindMode(x, naRm));
     return __result;
 END_RCPP
 }
 // findMean
-double findMean(SEXP x);
-RcppExport SEXP rasterfaster_findMean(SEXP xSEXP) {
+double findMean(SEXP x, bool naRm);
+RcppExport SEXP rasterfaster_findMean(SEXP xSEXP, SEXP naRmSEXP) {
 BEGIN_RCPP
     Rcpp::RObject __result;
     Rcpp::RNGScope __rngScope;
     Rcpp::traits::input_parameter< SEXP >::type x(xSEXP);
-    __result = Rcpp::wrap(findMean(x));
+    Rcpp::traits::input_parameter< bool >::type naRm(naRmSEXP);
+    __result = Rcpp::wrap(findMean(x, naRm));
     return __result;
 END_RCPP
 }
-// doColorRamp
-StringVector doColorRamp(NumericMatrix colors, NumericVector x, bool alpha, std::string naColor);
-RcppExport SEXP rasterfaster_doColorRamp(SEXP colorsSEXP, SEXP xSEXP, SEXP alphaSEXP, SEXP naColorSEXP) {
+// aggregate_files_numeric
+void aggregate_files_numeric(const std::string& from, int fromStride, int fromRows, int fromCols, double fromNA, const std::string& to, int toStride, int toRows, int toCols, double toNA, const std::string& dataFormat, const std::string& byteOrder, const std::string& toFormat, const std::string& fun, int xfact, int yfact, bool naRm, const std::string& output);
+RcppExport SEXP rasterfaster_aggregate_files_numeric(SEXP fromSEXP, SEXP fromStrideSEXP, SEXP fromRowsSEXP, SEXP fromColsSEXP, SEXP fromNASEXP, SEXP toSEXP, SEXP toStrideSEXP, SEXP toRowsSEXP, SEXP toColsSEXP, SEXP toNASEXP, SEXP dataFormatSEXP, SEXP byteOrderSEXP, SEXP toFormatSEXP, SEXP funSEXP, SEXP xfactSEXP, SEXP yfactSEXP, SEXP naRmSEXP, SEXP outputSEXP) {
+BEGIN_RCPP
+    Rcpp::RNGScope __rngScope;
+    Rcpp::traits::input_parameter< const std::string& >::type from(fromSEXP);
+    Rcpp::traits::input_parameter< int >::type fromStride(fromStrideSEXP);
+    Rcpp::traits::input_parameter< int >::type fromRows(fromRowsSEXP);
+    Rcpp::traits::input_parameter< int >::type fromCols(fromColsSEXP);
+    Rcpp::traits::input_parameter< double >::type fromNA(fromNASEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type to(toSEXP);
+    Rcpp::traits::input_parameter< int >::type toStride(toStrideSEXP);
+    Rcpp::traits::input_parameter< int >::type toRows(toRowsSEXP);
+    Rcpp::traits::input_parameter< int >::type toCols(toColsSEXP);
+    Rcpp::traits::input_parameter< double >::type toNA(toNASEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type dataFormat(dataFormatSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type byteOrder(byteOrderSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type toFormat(toFormatSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type fun(funSEXP);
+    Rcpp::traits::input_parameter< int >::type xfact(xfactSEXP);
+    Rcpp::traits::input_parameter< int >::type yfact(yfactSEXP);
+    Rcpp::traits::input_parameter< bool >::type naRm(naRmSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type output(outputSEXP);
+    aggregate_files_numeric(from, fromStride, fromRows, fromCols, fromNA, to, toStride, toRows, toCols, toNA, dataFormat, byteOrder, toFormat, fun, xfact, yfact, naRm, output);
+    return R_NilValue;
+END_RCPP
+}
+// makeColorRamp
+SEXP makeColorRamp(NumericMatrix colors, bool alpha, int resolution);
+RcppExport SEXP rasterfaster_makeColorRamp(SEXP colorsSEXP, SEXP alphaSEXP, SEXP resolutionSEXP) {
 BEGIN_RCPP
     Rcpp::RObject __result;
     Rcpp::RNGScope __rngScope;
     Rcpp::traits::input_parameter< NumericMatrix >::type colors(colorsSEXP);
-    Rcpp::traits::input_parameter< NumericVector >::type x(xSEXP);
     Rcpp::traits::input_parameter< bool >::type alpha(alphaSEXP);
+    Rcpp::traits::input_parameter< int >::type resolution(resolutionSEXP);
+    __result = Rcpp::wrap(makeColorRamp(colors, alpha, resolution));
+    return __result;
+END_RCPP
+}
+// colorRampIsValid
+bool colorRampIsValid(SEXP ramp);
+RcppExport SEXP rasterfaster_colorRampIsValid(SEXP rampSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject __result;
+    Rcpp::RNGScope __rngScope;
+    Rcpp::traits::input_parameter< SEXP >::type ramp(rampSEXP);
+    __result = Rcpp::wrap(colorRampIsValid(ramp));
+    return __result;
+END_RCPP
+}
+// doColorRamp
+StringVector doColorRamp(SEXP ramp, NumericVector x, std::string naColor);
+RcppExport SEXP rasterfaster_doColorRamp(SEXP rampSEXP, SEXP xSEXP, SEXP naColorSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject __result;
+    Rcpp::RNGScope __rngScope;
+    Rcpp::traits::input_parameter< SEXP >::type ramp(rampSEXP);
+    Rcpp::traits::input_parameter< NumericVector >::type x(xSEXP);
     Rcpp::traits::input_parameter< std::string >::type naColor(naColorSEXP);
-    __result = Rcpp::wrap(doColorRamp(colors, x, alpha, naColor));
+    __result = Rcpp::wrap(doColorRamp(ramp, x, naColor));
+    return __result;
+END_RCPP
+}
+// doColorRampNative
+IntegerVector doColorRampNative(SEXP ramp, NumericVector x, IntegerVector naColor, int nrow);
+RcppExport SEXP rasterfaster_doColorRampNative(SEXP rampSEXP, SEXP xSEXP, SEXP naColorSEXP, SEXP nrowSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject __result;
+    Rcpp::RNGScope __rngScope;
+    Rcpp::traits::input_parameter< SEXP >::type ramp(rampSEXP);
+    Rcpp::traits::input_parameter< NumericVector >::type x(xSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type naColor(naColorSEXP);
+    Rcpp::traits::input_parameter< int >::type nrow(nrowSEXP);
+    __result = Rcpp::wrap(doColorRampNative(ramp, x, naColor, nrow));
     return __result;
 END_RCPP
 }
@@ -63,50 +129,229 @@ BEGIN_RCPP
     return __result;
 END_RCPP
 }
-// do_project
-void do_project(const std::string& name, const std::string& from, int fromStride, int fromRows, int fromCols, int lng1, int lng2, int lat1, int lat2, const std::string& to, int toStride, int toRows, int toCols, int x, int y, int totalWidth, int totalHeight, const std::string& dataFormat, const std::string& method);
-RcppExport SEXP rasterfaster_do_project(SEXP nameSEXP, SEXP fromSEXP, SEXP fromStrideSEXP, SEXP fromRowsSEXP, SEXP fromColsSEXP, SEXP lng1SEXP, SEXP lng2SEXP, SEXP lat1SEXP, SEXP lat2SEXP, SEXP toSEXP, SEXP toStrideSEXP, SEXP toRowsSEXP, SEXP toColsSEXP, SEXP xSEXP, SEXP ySEXP, SEXP totalWidthSEXP, SEXP totalHeightSEXP, SEXP dataFormatSEXP, SEXP methodSEXP) {
+// do_project_tiles
+void do_project_tiles(const std::string& name, const std::string& from, bool tiled, SEXP source, int fromStride, int fromRows, int fromCols, double fromNA, int lng1, int lng2, int lat1, int lat2, const std::vector<std::string>& to, int toStride, int toRows, int toCols, double toNA, const std::vector<int>& x, const std::vector<int>& y, int totalWidth, int totalHeight, int bands, const std::string& bandOrder, const std::string& dataFormat, const std::string& byteOrder, const std::string& method, int blockSize);
+RcppExport SEXP rasterfaster_do_project_tiles(SEXP nameSEXP, SEXP fromSEXP, SEXP tiledSEXP, SEXP sourceSEXP, SEXP fromStrideSEXP, SEXP fromRowsSEXP, SEXP fromColsSEXP, SEXP fromNASEXP, SEXP lng1SEXP, SEXP lng2SEXP, SEXP lat1SEXP, SEXP lat2SEXP, SEXP toSEXP, SEXP toStrideSEXP, SEXP toRowsSEXP, SEXP toColsSEXP, SEXP toNASEXP, SEXP xSEXP, SEXP ySEXP, SEXP totalWidthSEXP, SEXP totalHeightSEXP, SEXP bandsSEXP, SEXP bandOrderSEXP, SEXP dataFormatSEXP, SEXP byteOrderSEXP, SEXP methodSEXP, SEXP blockSizeSEXP) {
 BEGIN_RCPP
     Rcpp::RNGScope __rngScope;
     Rcpp::traits::input_parameter< const std::string& >::type name(nameSEXP);
     Rcpp::traits::input_parameter< const std::string& >::type from(fromSEXP);
+    Rcpp::traits::input_parameter< bool >::type tiled(tiledSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type source(sourceSEXP);
     Rcpp::traits::input_parameter< int >::type fromStride(fromStrideSEXP);
     Rcpp::traits::input_parameter< int >::type fromRows(fromRowsSEXP);
     Rcpp::traits::input_parameter< int >::type fromCols(fromColsSEXP);
+    Rcpp::traits::input_parameter< double >::type fromNA(fromNASEXP);
     Rcpp::traits::input_parameter< int >::type lng1(lng1SEXP);
     Rcpp::traits::input_parameter< int >::type lng2(lng2SEXP);
     Rcpp::traits::input_parameter< int >::type lat1(lat1SEXP);
     Rcpp::traits::input_parameter< int >::type lat2(lat2SEXP);
-    Rcpp::traits::input_parameter< const std::string& >::type to(toSEXP);
+    Rcpp::traits::input_parameter< const std::vector<std::string>& >::type to(toSEXP);
     Rcpp::traits::input_parameter< int >::type toStride(toStrideSEXP);
     Rcpp::traits::input_parameter< int >::type toRows(toRowsSEXP);
     Rcpp::traits::input_parameter< int >::type toCols(toColsSEXP);
+    Rcpp::traits::input_parameter< double >::type toNA(toNASEXP);
+    Rcpp::traits::input_parameter< const std::vector<int>& >::type x(xSEXP);
+    Rcpp::traits::input_parameter< const std::vector<int>& >::type y(ySEXP);
+    Rcpp::traits::input_parameter< int >::type totalWidth(totalWidthSEXP);
+    Rcpp::traits::input_parameter< int >::type totalHeight(totalHeightSEXP);
+    Rcpp::traits::input_parameter< int >::type bands(bandsSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type bandOrder(bandOrderSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type dataFormat(dataFormatSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type byteOrder(byteOrderSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type method(methodSEXP);
+    Rcpp::traits::input_parameter< int >::type blockSize(blockSizeSEXP);
+    do_project_tiles(name, from, tiled, source, fromStride, fromRows, fromCols, fromNA, lng1, lng2, lat1, lat2, to, toStride, toRows, toCols, toNA, x, y, totalWidth, totalHeight, bands, bandOrder, dataFormat, byteOrder, method, blockSize);
+    return R_NilValue;
+END_RCPP
+}
+// tile_cache_stats
+NumericVector tile_cache_stats(double budget);
+RcppExport SEXP rasterfaster_tile_cache_stats(SEXP budgetSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject __result;
+    Rcpp::RNGScope __rngScope;
+    Rcpp::traits::input_parameter< double >::type budget(budgetSEXP);
+    __result = Rcpp::wrap(tile_cache_stats(budget));
+    return __result;
+END_RCPP
+}
+// do_project_values
+List do_project_values(const std::string& name, const std::string& from, bool tiled, SEXP source, int fromStride, int fromRows, int fromCols, int lng1, int lng2, int lat1, int lat2, int toRows, int toCols, const std::vector<int>& x, const std::vector<int>& y, int totalWidth, int totalHeight, int bands, const std::string& bandOrder, const std::string& dataFormat, const std::string& byteOrder, const std::string& method, int blockSize, double nodata);
+RcppExport SEXP rasterfaster_do_project_values(SEXP nameSEXP, SEXP fromSEXP, SEXP tiledSEXP, SEXP sourceSEXP, SEXP fromStrideSEXP, SEXP fromRowsSEXP, SEXP fromColsSEXP, SEXP lng1SEXP, SEXP lng2SEXP, SEXP lat1SEXP, SEXP lat2SEXP, SEXP toRowsSEXP, SEXP toColsSEXP, SEXP xSEXP, SEXP ySEXP, SEXP totalWidthSEXP, SEXP totalHeightSEXP, SEXP bandsSEXP, SEXP bandOrderSEXP, SEXP dataFormatSEXP, SEXP byteOrderSEXP, SEXP methodSEXP, SEXP blockSizeSEXP, SEXP nodataSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject __result;
+    Rcpp::RNGScope __rngScope;
+    Rcpp::traits::input_parameter< const std::string& >::type name(nameSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type from(fromSEXP);
+    Rcpp::traits::input_parameter< bool >::type tiled(tiledSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type source(sourceSEXP);
+    Rcpp::traits::input_parameter< int >::type fromStride(fromStrideSEXP);
+    Rcpp::traits::input_parameter< int >::type fromRows(fromRowsSEXP);
+    Rcpp::traits::input_parameter< int >::type fromCols(fromColsSEXP);
+    Rcpp::traits::input_parameter< int >::type lng1(lng1SEXP);
+    Rcpp::traits::input_parameter< int >::type lng2(lng2SEXP);
+    Rcpp::traits::input_parameter< int >::type lat1(lat1SEXP);
+    Rcpp::traits::input_parameter< int >::type lat2(lat2SEXP);
+    Rcpp::traits::input_parameter< int >::type toRows(toRowsSEXP);
+    Rcpp::traits::input_parameter< int >::type toCols(toColsSEXP);
+    Rcpp::traits::input_parameter< const std::vector<int>& >::type x(xSEXP);
+    Rcpp::traits::input_parameter< const std::vector<int>& >::type y(ySEXP);
+    Rcpp::traits::input_parameter< int >::type totalWidth(totalWidthSEXP);
+    Rcpp::traits::input_parameter< int >::type totalHeight(totalHeightSEXP);
+    Rcpp::traits::input_parameter< int >::type bands(bandsSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type bandOrder(bandOrderSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type dataFormat(dataFormatSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type byteOrder(byteOrderSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type method(methodSEXP);
+    Rcpp::traits::input_parameter< int >::type blockSize(blockSizeSEXP);
+    Rcpp::traits::input_parameter< double >::type nodata(nodataSEXP);
+    __result = Rcpp::wrap(do_project_values(name, from, tiled, source, fromStride, fromRows, fromCols, lng1, lng2, lat1, lat2, toRows, toCols, x, y, totalWidth, totalHeight, bands, bandOrder, dataFormat, byteOrder, method, blockSize, nodata));
+    return __result;
+END_RCPP
+}
+// do_project_png
+RawVector do_project_png(const std::string& name, const std::string& from, bool tiled, SEXP source, int fromStride, int fromRows, int fromCols, double fromNA, int lng1, int lng2, int lat1, int lat2, int width, int height, int x, int y, int totalWidth, int totalHeight, const std::string& dataFormat, const std::string& byteOrder, const std::string& method, int blockSize, const std::vector<double>& colors, double lo, double hi, const std::vector<int>& naColor, int tableSize, int compression);
+RcppExport SEXP rasterfaster_do_project_png(SEXP nameSEXP, SEXP fromSEXP, SEXP tiledSEXP, SEXP sourceSEXP, SEXP fromStrideSEXP, SEXP fromRowsSEXP, SEXP fromColsSEXP, SEXP fromNASEXP, SEXP lng1SEXP, SEXP lng2SEXP, SEXP lat1SEXP, SEXP lat2SEXP, SEXP widthSEXP, SEXP heightSEXP, SEXP xSEXP, SEXP ySEXP, SEXP totalWidthSEXP, SEXP totalHeightSEXP, SEXP dataFormatSEXP, SEXP byteOrderSEXP, SEXP methodSEXP, SEXP blockSizeSEXP, SEXP colorsSEXP, SEXP loSEXP, SEXP hiSEXP, SEXP naColorSEXP, SEXP tableSizeSEXP, SEXP compressionSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject __result;
+    Rcpp::RNGScope __rngScope;
+    Rcpp::traits::input_parameter< const std::string& >::type name(nameSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type from(fromSEXP);
+    Rcpp::traits::input_parameter< bool >::type tiled(tiledSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type source(sourceSEXP);
+    Rcpp::traits::input_parameter< int >::type fromStride(fromStrideSEXP);
+    Rcpp::traits::input_parameter< int >::type fromRows(fromRowsSEXP);
+    Rcpp::traits::input_parameter< int >::type fromCols(fromColsSEXP);
+    Rcpp::traits::input_parameter< double >::type fromNA(fromNASEXP);
+    Rcpp::traits::input_parameter< int >::type lng1(lng1SEXP);
+    Rcpp::traits::input_parameter< int >::type lng2(lng2SEXP);
+    Rcpp::traits::input_parameter< int >::type lat1(lat1SEXP);
+    Rcpp::traits::input_parameter< int >::type lat2(lat2SEXP);
+    Rcpp::traits::input_parameter< int >::type width(widthSEXP);
+    Rcpp::traits::input_parameter< int >::type height(heightSEXP);
     Rcpp::traits::input_parameter< int >::type x(xSEXP);
     Rcpp::traits::input_parameter< int >::type y(ySEXP);
     Rcpp::traits::input_parameter< int >::type totalWidth(totalWidthSEXP);
     Rcpp::traits::input_parameter< int >::type totalHeight(totalHeightSEXP);
     Rcpp::traits::input_parameter< const std::string& >::type dataFormat(dataFormatSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type byteOrder(byteOrderSEXP);
     Rcpp::traits::input_parameter< const std::string& >::type method(methodSEXP);
-    do_project(name, from, fromStride, fromRows, fromCols, lng1, lng2, lat1, lat2, to, toStride, toRows, toCols, x, y, totalWidth, totalHeight, dataFormat, method);
-    return R_NilValue;
+    Rcpp::traits::input_parameter< int >::type blockSize(blockSizeSEXP);
+    Rcpp::traits::input_parameter< const std::vector<double>& >::type colors(colorsSEXP);
+    Rcpp::traits::input_parameter< double >::type lo(loSEXP);
+    Rcpp::traits::input_parameter< double >::type hi(hiSEXP);
+    Rcpp::traits::input_parameter< const std::vector<int>& >::type naColor(naColorSEXP);
+    Rcpp::traits::input_parameter< int >::type tableSize(tableSizeSEXP);
+    Rcpp::traits::input_parameter< int >::type compression(compressionSEXP);
+    __result = Rcpp::wrap(do_project_png(name, from, tiled, source, fromStride, fromRows, fromCols, fromNA, lng1, lng2, lat1, lat2, width, height, x, y, totalWidth, totalHeight, dataFormat, byteOrder, method, blockSize, colors, lo, hi, naColor, tableSize, compression));
+    return __result;
+END_RCPP
+}
+// openRasterSource
+SEXP openRasterSource(const std::string& from, bool tiled, int fromStride, int fromRows, int fromCols, int bands, const std::string& bandOrder, const std::string& dataFormat, const std::string& byteOrder);
+RcppExport SEXP rasterfaster_openRasterSource(SEXP fromSEXP, SEXP tiledSEXP, SEXP fromStrideSEXP, SEXP fromRowsSEXP, SEXP fromColsSEXP, SEXP bandsSEXP, SEXP bandOrderSEXP, SEXP dataFormatSEXP, SEXP byteOrderSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject __result;
+    Rcpp::RNGScope __rngScope;
+    Rcpp::traits::input_parameter< const std::string& >::type from(fromSEXP);
+    Rcpp::traits::input_parameter< bool >::type tiled(tiledSEXP);
+    Rcpp::traits::input_parameter< int >::type fromStride(fromStrideSEXP);
+    Rcpp::traits::input_parameter< int >::type fromRows(fromRowsSEXP);
+    Rcpp::traits::input_parameter< int >::type fromCols(fromColsSEXP);
+    Rcpp::traits::input_parameter< int >::type bands(bandsSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type bandOrder(bandOrderSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type dataFormat(dataFormatSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type byteOrder(byteOrderSEXP);
+    __result = Rcpp::wrap(openRasterSource(from, tiled, fromStride, fromRows, fromCols, bands, bandOrder, dataFormat, byteOrder));
+    return __result;
+END_RCPP
+}
+// rasterSourceIsValid
+bool rasterSourceIsValid(SEXP source);
+RcppExport SEXP rasterfaster_rasterSourceIsValid(SEXP sourceSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject __result;
+    Rcpp::RNGScope __rngScope;
+    Rcpp::traits::input_parameter< SEXP >::type source(sourceSEXP);
+    __result = Rcpp::wrap(rasterSourceIsValid(source));
+    return __result;
 END_RCPP
 }
 // resample_files_numeric
-void resample_files_numeric(const std::string& from, int fromStride, int fromRows, int fromCols, const std::string& to, int toStride, int toRows, int toCols, const std::string& dataFormat, const std::string& method);
-RcppExport SEXP rasterfaster_resample_files_numeric(SEXP fromSEXP, SEXP fromStrideSEXP, SEXP fromRowsSEXP, SEXP fromColsSEXP, SEXP toSEXP, SEXP toStrideSEXP, SEXP toRowsSEXP, SEXP toColsSEXP, SEXP dataFormatSEXP, SEXP methodSEXP) {
+void resample_files_numeric(const std::string& from, int fromStride, int fromRows, int fromCols, double fromNA, const std::string& to, int toStride, int toRows, int toCols, double toNA, int bands, const std::string& bandOrder, const std::string& dataFormat, const std::string& byteOrder, const std::string& method, int blockSize, const std::string& output);
+RcppExport SEXP rasterfaster_resample_files_numeric(SEXP fromSEXP, SEXP fromStrideSEXP, SEXP fromRowsSEXP, SEXP fromColsSEXP, SEXP fromNASEXP, SEXP toSEXP, SEXP toStrideSEXP, SEXP toRowsSEXP, SEXP toColsSEXP, SEXP toNASEXP, SEXP bandsSEXP, SEXP bandOrderSEXP, SEXP dataFormatSEXP, SEXP byteOrderSEXP, SEXP methodSEXP, SEXP blockSizeSEXP, SEXP outputSEXP) {
 BEGIN_RCPP
     Rcpp::RNGScope __rngScope;
     Rcpp::traits::input_parameter< const std::string& >::type from(fromSEXP);
     Rcpp::traits::input_parameter< int >::type fromStride(fromStrideSEXP);
     Rcpp::traits::input_parameter< int >::type fromRows(fromRowsSEXP);
     Rcpp::traits::input_parameter< int >::type fromCols(fromColsSEXP);
+    Rcpp::traits::input_parameter< double >::type fromNA(fromNASEXP);
     Rcpp::traits::input_parameter< const std::string& >::type to(toSEXP);
     Rcpp::traits::input_parameter< int >::type toStride(toStrideSEXP);
     Rcpp::traits::input_parameter< int >::type toRows(toRowsSEXP);
     Rcpp::traits::input_parameter< int >::type toCols(toColsSEXP);
+    Rcpp::traits::input_parameter< double >::type toNA(toNASEXP);
+    Rcpp::traits::input_parameter< int >::type bands(bandsSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type bandOrder(bandOrderSEXP);
     Rcpp::traits::input_parameter< const std::string& >::type dataFormat(dataFormatSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type byteOrder(byteOrderSEXP);
     Rcpp::traits::input_parameter< const std::string& >::type method(methodSEXP);
-    resample_files_numeric(from, fromStride, fromRows, fromCols, to, toStride, toRows, toCols, dataFormat, method);
+    Rcpp::traits::input_parameter< int >::type blockSize(blockSizeSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type output(outputSEXP);
+    resample_files_numeric(from, fromStride, fromRows, fromCols, fromNA, to, toStride, toRows, toCols, toNA, bands, bandOrder, dataFormat, byteOrder, method, blockSize, output);
+    return R_NilValue;
+END_RCPP
+}
+// resample_values_numeric
+NumericVector resample_values_numeric(const std::string& from, int fromStride, int fromRows, int fromCols, int toRows, int toCols, int bands, const std::string& bandOrder, const std::string& dataFormat, const std::string& byteOrder, const std::string& method, int blockSize, double nodata);
+RcppExport SEXP rasterfaster_resample_values_numeric(SEXP fromSEXP, SEXP fromStrideSEXP, SEXP fromRowsSEXP, SEXP fromColsSEXP, SEXP toRowsSEXP, SEXP toColsSEXP, SEXP bandsSEXP, SEXP bandOrderSEXP, SEXP dataFormatSEXP, SEXP byteOrderSEXP, SEXP methodSEXP, SEXP blockSizeSEXP, SEXP nodataSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject __result;
+    Rcpp::RNGScope __rngScope;
+    Rcpp::traits::input_parameter< const std::string& >::type from(fromSEXP);
+    Rcpp::traits::input_parameter< int >::type fromStride(fromStrideSEXP);
+    Rcpp::traits::input_parameter< int >::type fromRows(fromRowsSEXP);
+    Rcpp::traits::input_parameter< int >::type fromCols(fromColsSEXP);
+    Rcpp::traits::input_parameter< int >::type toRows(toRowsSEXP);
+    Rcpp::traits::input_parameter< int >::type toCols(toColsSEXP);
+    Rcpp::traits::input_parameter< int >::type bands(bandsSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type bandOrder(bandOrderSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type dataFormat(dataFormatSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type byteOrder(byteOrderSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type method(methodSEXP);
+    Rcpp::traits::input_parameter< int >::type blockSize(blockSizeSEXP);
+    Rcpp::traits::input_parameter< double >::type nodata(nodataSEXP);
+    __result = Rcpp::wrap(resample_values_numeric(from, fromStride, fromRows, fromCols, toRows, toCols, bands, bandOrder, dataFormat, byteOrder, method, blockSize, nodata));
+    return __result;
+END_RCPP
+}
+// simd_level
+std::string simd_level(const std::string& level);
+RcppExport SEXP rasterfaster_simd_level(SEXP levelSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject __result;
+    Rcpp::RNGScope __rngScope;
+    Rcpp::traits::input_parameter< const std::string& >::type level(levelSEXP);
+    __result = Rcpp::wrap(simd_level(level));
+    return __result;
+END_RCPP
+}
+// retile_file
+void retile_file(const std::string& from, int fromStride, int fromRows, int fromCols, int bands, const std::string& bandOrder, const std::string& dataFormat, const std::string& to);
+RcppExport SEXP rasterfaster_retile_file(SEXP fromSEXP, SEXP fromStrideSEXP, SEXP fromRowsSEXP, SEXP fromColsSEXP, SEXP bandsSEXP, SEXP bandOrderSEXP, SEXP dataFormatSEXP, SEXP toSEXP) {
+BEGIN_RCPP
+    Rcpp::RNGScope __rngScope;
+    Rcpp::traits::input_parameter< const std::string& >::type from(fromSEXP);
+    Rcpp::traits::input_parameter< int >::type fromStride(fromStrideSEXP);
+    Rcpp::traits::input_parameter< int >::type fromRows(fromRowsSEXP);
+    Rcpp::traits::input_parameter< int >::type fromCols(fromColsSEXP);
+    Rcpp::traits::input_parameter< int >::type bands(bandsSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type bandOrder(bandOrderSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type dataFormat(dataFormatSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type to(toSEXP);
+    retile_file(from, fromStride, fromRows, fromCols, bands, bandOrder, dataFormat, to);
     return R_NilValue;
 END_RCPP
 }
@@ -1,5 +1,14 @@
 #include <Rcpp.h>
+// [[Rcpp::depends(RcppParallel)]]
+#include <RcppParallel.h>
+#include <tbb/enumerable_thread_specific.h>
+
 #include "aggregate.hpp"
+#include "byteswap.hpp"
+#include "grid.hpp"
+#include "mmfile.hpp"
+#include "output.hpp"
+#include "resample_algos.hpp"
 
 using namespace Rcpp;
 
@@ -8,47 +17,420 @@ T naValue();
 
 template<> int32_t naValue() { return NA_INTEGER; }
 template<> double naValue() { return NA_REAL; }
-template<> Rcpp::String naValue() { return NA_STRING; }
-template<> bool naValue() { return NA_LOGICAL; }
 
 template <int RTYPE, class T>
-Vector<RTYPE> find_mode(const Vector<RTYPE>& x) {
-  if (x.size() == 0) {
-    return Vector<RTYPE>::create(naValue<T>());
-  }
-
+Vector<RTYPE> find_mode(const Vector<RTYPE>& x, bool naRm) {
+  // Ties are broken with R's random number generator, so set.seed() makes
+  // the result reproducible
   T result;
-  if (mode(x.begin(), x.end(), &result)) {
+  if (mode(x.begin(), x.end(), naRm, ::unif_rand(), &result)) {
     return Vector<RTYPE>::create(result);
   }
-  Rcpp::stop("Couldn't find mode of x");
-  throw;
+  // No values (or only NAs, which were removed)
+  return Vector<RTYPE>::create(naValue<T>());
+}
+
+template <>
+struct MissingValue<Rcpp::String> {
+  static bool test(const Rcpp::String& value) { return value.get_sexp() == NA_STRING; }
+};
+
+StringVector find_string_mode(const StringVector& x, bool naRm) {
+  Rcpp::String result;
+  if (sort_mode(x.begin(), x.end(), naRm, ::unif_rand(), &result)) {
+    return StringVector::create(result);
+  }
+  return StringVector::create(NA_STRING);
 }
 
 // [[Rcpp::export]]
-SEXP doFindMode(SEXP x) {
+SEXP doFindMode(SEXP x, bool naRm) {
   switch (TYPEOF(x)) {
-  case INTSXP: return find_mode<INTSXP, int32_t>(x);
-  case REALSXP: return find_mode<REALSXP, double>(x);
-  case STRSXP: return find_mode<STRSXP, Rcpp::String>(x);
-  case LGLSXP: return find_mode<LGLSXP, bool>(x);
+  case INTSXP: return find_mode<INTSXP, int32_t>(x, naRm);
+  case REALSXP: return find_mode<REALSXP, double>(x, naRm);
+  case STRSXP: return find_string_mode(x, naRm);
+  // Logicals are stored as integers, with NA as a third value
+  case LGLSXP: return find_mode<LGLSXP, int32_t>(x, naRm);
   }
   Rcpp::stop("findMode only works on integer, real, character, and logical vectors");
   throw;
 }
 
+// Whether a vector with missing values has an NA (or only NaNs); integers
+// have no NaN.
+bool has_na(const int32_t* begin, const int32_t* end) {
+  return true;
+}
+bool has_na(const double* begin, const double* end) {
+  for (; begin != end; begin++) {
+    if (R_IsNA(*begin)) {
+      return true;
+    }
+  }
+  return false;
+}
+
 template <class TVector>
-double find_mean(SEXP x) {
+double find_mean(SEXP x, bool naRm) {
   TVector xv(x);
-  return mean(xv.begin(), xv.end());
+  size_t missing;
+  double result = mean(xv.begin(), xv.end(), &missing);
+  if (missing > 0 && !naRm) {
+    return has_na(xv.begin(), xv.end()) ? NA_REAL : R_NaN;
+  }
+  return result;
 }
 
 // [[Rcpp::export]]
-double findMean(SEXP x) {
+double findMean(SEXP x, bool naRm) {
   switch (TYPEOF(x)) {
-  case INTSXP: return find_mean<IntegerVector>(x);
-  case REALSXP: return find_mean<NumericVector>(x);
+  case INTSXP: return find_mean<IntegerVector>(x, naRm);
+  case REALSXP: return find_mean<NumericVector>(x, naRm);
   }
   Rcpp::stop("findMean only works on integer and real vectors");
   throw;
 }
+
+enum AggregateFun {
+  AGGREGATE_MEAN,
+  AGGREGATE_MODE,
+  AGGREGATE_MIN,
+  AGGREGATE_MAX,
+  AGGREGATE_SUM
+};
+
+// The most bytes of a source in the other byte order than the host's that
+// an AggregateWorker swaps at a time: its target rows are worked through in
+// runs of cells whose windows fit, so that they're still in cache when
+// they're read.
+const size_t AGGREGATE_SWAP_BYTES = 256 * 1024;
+
+// Combines each xfact-by-yfact window of source cells into one target cell.
+// Output rows are processed in parallel; each thread keeps its own scratch
+// space for the window's values, which is reused from cell to cell and from
+// one chunk of rows to the next.
+template <class T, class TOut>
+class AggregateWorker : public RcppParallel::Worker {
+  Grid<T>* pSrc;
+  Grid<TOut>* pTgt;
+  AggregateFun fun;
+  index_t xfact, yfact;
+  bool naRm;
+  // The source's nodata value, if T can represent it
+  bool hasNA;
+  T srcNA;
+  TOut tgtNA;
+  uint64_t seed;
+  DoubleSumKernel sumKernel;
+  // Swaps source cells into host order; NULL if they're in host order
+  ByteSwapKernel swapKernel;
+  // The target cells of a row that are worked through at a time; if cells
+  // are swapped, only as many as have windows that fit AGGREGATE_SWAP_BYTES
+  index_t runCells;
+
+  // One thread's scratch space: the window's values (for means, sums and
+  // modes), the source rows of the current run of target cells, and those
+  // rows' swapped cells
+  struct Scratch {
+    std::vector<double> values;
+    WindowMode<T> modes;
+    std::vector<const T*> rows;
+    std::vector<char> swapped;
+
+    Scratch(AggregateFun fun, index_t windowSize, index_t rowCount, size_t swappedBytes) :
+      values(fun == AGGREGATE_MEAN || fun == AGGREGATE_SUM ? windowSize : 0),
+      modes(fun == AGGREGATE_MODE ? windowSize : 0),
+      rows(rowCount), swapped(swappedBytes) {
+    }
+  };
+  // Each thread's Scratch, copied from the one the worker is constructed
+  // with the first time the thread renders, and reused for its later chunks
+  tbb::enumerable_thread_specific<Scratch> scratch;
+
+  bool isMissing(T value) const {
+    // NaN is always missing, like NA
+    return value != value || (hasNA && value == srcNA);
+  }
+
+  // Each of these combines the window of source cells [col0, col1) of the
+  // nrows rows that start at rows[0] to rows[nrows - 1], and returns false
+  // if the result is NA.
+
+  bool sum(const T* const* rows, index_t nrows, index_t col0, index_t col1,
+    double* values, double* result, size_t* count) const {
+
+    // Missing values become NaN, which the sum kernel counts and skips
+    size_t n = 0;
+    for (index_t row = 0; row < nrows; row++) {
+      const T* src = rows[row] + col0;
+      for (index_t i = 0; i < col1 - col0; i++) {
+        values[n++] = isMissing(src[i]) ?
+          std::numeric_limits<double>::quiet_NaN() : static_cast<double>(src[i]);
+      }
+    }
+    DoubleSum sums;
+    size_t missing;
+    sumKernel(values, n, &sums);
+    *result = add_sums(&sums, 1, &missing);
+    *count = n - missing;
+    return *count > 0 && (missing == 0 || naRm);
+  }
+
+  bool range(const T* const* rows, index_t nrows, index_t col0, index_t col1,
+    T* lo, T* hi) const {
+
+    typedef std::numeric_limits<T> limits;
+    *lo = limits::has_infinity ? limits::infinity() : limits::max();
+    *hi = limits::has_infinity ? -limits::infinity() : limits::min();
+    size_t missing = 0;
+    for (index_t row = 0; row < nrows; row++) {
+      const T* src = rows[row] + col0;
+      for (index_t i = 0; i < col1 - col0; i++) {
+        bool skip = isMissing(src[i]);
+        missing += skip;
+        *lo = skip ? *lo : std::min(*lo, src[i]);
+        *hi = skip ? *hi : std::max(*hi, src[i]);
+      }
+    }
+    size_t n = nrows * (col1 - col0);
+    return missing < n && (missing == 0 || naRm);
+  }
+
+  bool mode(const T* const* rows, index_t nrows, index_t col0, index_t col1,
+    WindowMode<T>* modes, double u, T* result) const {
+
+    size_t missing = 0;
+    for (index_t row = 0; row < nrows; row++) {
+      const T* src = rows[row] + col0;
+      for (index_t i = 0; i < col1 - col0; i++) {
+        if (isMissing(src[i])) {
+          missing++;
+        } else {
+          modes->add(src[i]);
+        }
+      }
+    }
+    // Finding the result also clears out the window's values
+    return modes->result(u, result) && (missing == 0 || naRm);
+  }
+
+  // Renders target cells [x0, x1) of target row y into out, from the source
+  // rows that start at rows[0] to rows[nrows - 1] at column runCol0.
+  void renderRun(const T* const* rows, index_t nrows, index_t y, index_t x0,
+    index_t x1, index_t runCol0, std::vector<double>* values,
+    WindowMode<T>* modes, TOut* out) {
+
+    for (index_t x = x0; x < x1; x++) {
+      index_t col0 = x * xfact - runCol0;
+      index_t col1 = std::min((x + 1) * xfact, pSrc->ncol()) - runCol0;
+
+      double total;
+      size_t count;
+      T lo, hi, result;
+      switch (fun) {
+      case AGGREGATE_MEAN:
+        out[x] = sum(rows, nrows, col0, col1, &(*values)[0], &total, &count) ?
+          static_cast<TOut>(total / count) : tgtNA;
+        break;
+      case AGGREGATE_SUM:
+        out[x] = sum(rows, nrows, col0, col1, &(*values)[0], &total, &count) ?
+          static_cast<TOut>(total) : tgtNA;
+        break;
+      case AGGREGATE_MIN:
+        out[x] = range(rows, nrows, col0, col1, &lo, &hi) ?
+          static_cast<TOut>(lo) : tgtNA;
+        break;
+      case AGGREGATE_MAX:
+        out[x] = range(rows, nrows, col0, col1, &lo, &hi) ?
+          static_cast<TOut>(hi) : tgtNA;
+        break;
+      case AGGREGATE_MODE:
+        out[x] = mode(rows, nrows, col0, col1, modes,
+          hash_uniform(seed, y * pTgt->ncol() + x), &result) ?
+          static_cast<TOut>(result) : tgtNA;
+        break;
+      }
+    }
+  }
+
+public:
+  // pSrc is in the other byte order than the host's if swapBytes is set
+  AggregateWorker(Grid<T>* pSrc, bool swapBytes, Grid<TOut>* pTgt, AggregateFun fun,
+    index_t xfact, index_t yfact, bool naRm, double srcNA, double tgtNA,
+    uint64_t seed, SimdLevel level) :
+  pSrc(pSrc), pTgt(pTgt), fun(fun), xfact(xfact), yfact(yfact), naRm(naRm),
+  srcNA(saturate_cast<T>(srcNA)), tgtNA(saturate_cast<TOut>(tgtNA)),
+  seed(seed), sumKernel(doubleSumKernel(level)),
+  swapKernel(swapBytes && sizeof(T) > 1 ? byteSwapKernel<T>(level) : NULL),
+  runCells(swapKernel ?
+    std::max<index_t>(1, AGGREGATE_SWAP_BYTES / (xfact * yfact * sizeof(T))) :
+    pTgt->ncol()),
+  scratch(Scratch(fun, xfact * yfact, yfact,
+    swapKernel ? runCells * xfact * yfact * sizeof(T) : 0)) {
+    // Float data holds the nodata value rounded to float
+    hasNA = !std::numeric_limits<T>::is_integer ||
+      static_cast<double>(this->srcNA) == srcNA;
+  }
+
+  // begin and end are target row numbers
+  void operator()(std::size_t begin, std::size_t end) {
+    render(begin, end, pTgt);
+  }
+
+  // Renders target rows begin to end into pOut, which is the target or a
+  // window onto those rows.
+  void render(std::size_t begin, std::size_t end, Grid<TOut>* pOut) {
+    Scratch& local = scratch.local();
+    // The source rows of the current target row, from the first column of
+    // the current run of target cells on. Swapped cells go into
+    // local.swapped.
+    std::vector<const T*>& rows = local.rows;
+
+    for (index_t y = begin; y < end; y++) {
+      index_t row0 = y * yfact;
+      index_t row1 = std::min(row0 + yfact, pSrc->nrow());
+      index_t nrows = row1 - row0;
+      TOut* out = pOut->at(y, 0);
+
+      for (index_t x0 = 0; x0 < pTgt->ncol(); x0 += runCells) {
+        index_t x1 = std::min(x0 + runCells, pTgt->ncol());
+        index_t runCol0 = x0 * xfact;
+        index_t runCol1 = std::min(x1 * xfact, pSrc->ncol());
+        for (index_t row = 0; row < nrows; row++) {
+          rows[row] = pSrc->at(row0 + row, runCol0);
+          if (swapKernel) {
+            T* swapped = reinterpret_cast<T*>(&local.swapped[0]) + row * (runCol1 - runCol0);
+            swapKernel(rows[row], swapped, runCol1 - runCol0);
+            rows[row] = swapped;
+          }
+        }
+        renderRun(&rows[0], nrows, y, x0, x1, runCol0, &local.values, &local.modes, out);
+      }
+    }
+  }
+};
+
+// Aggregates the file from, which is in the other byte order than the host's
+// if swapBytes is set, into the file to, which is in host order.
+template <class T, class TOut>
+void aggregate_files(AggregateFun fun,
+  const std::string& from, bool swapBytes,
+  index_t fromStride, index_t fromRows, index_t fromCols,
+  double fromNA,
+  const std::string& to, index_t toStride, index_t toRows, index_t toCols,
+  double toNA,
+  index_t xfact, index_t yfact, bool naRm, OutputBackend output) {
+
+  // Memory mapped source, which is read front to back; the target is only
+  // mapped for OUTPUT_MMAP
+  MMFile<T> from_f(from, boost::interprocess::read_only,
+    MM_ACCESS_SEQUENTIAL, true);
+
+  Grid<T> from_g(from_f.begin(), from_f.end(), fromStride, fromRows, fromCols);
+  OutputTarget<TOut> target(to, output, toStride, toRows, toCols);
+
+  if ((toRows - 1) * yfact >= fromRows || (toCols - 1) * xfact >= fromCols ||
+    toRows * yfact < fromRows || toCols * xfact < fromCols) {
+    Rcpp::stop("The target raster's dimensions don't match the aggregation factor");
+  }
+
+  // Ties between modes are broken with R's random number generator, so
+  // set.seed() makes the result reproducible
+  uint64_t seed = static_cast<uint64_t>(::unif_rand() * 4294967296.0);
+
+  AggregateWorker<T, TOut> worker(&from_g, swapBytes, target.grid(), fun, xfact, yfact,
+    naRm, fromNA, toNA, seed, simdLevel());
+  // Streamed output goes out in bands of about a megabyte
+  index_t bandRows = std::max<index_t>(1, (1 << 20) / (toStride * sizeof(TOut)));
+  target.render(&worker, bandRows, bandRows, toRows);
+}
+
+// Means and sums may be written as doubles, whatever the source's type;
+// everything else is written in the source's type.
+template <class T>
+void aggregate_files(AggregateFun fun, const std::string& toFormat,
+  const std::string& dataFormat,
+  const std::string& from, bool swapBytes,
+  index_t fromStride, index_t fromRows, index_t fromCols,
+  double fromNA,
+  const std::string& to, index_t toStride, index_t toRows, index_t toCols,
+  double toNA,
+  index_t xfact, index_t yfact, bool naRm, OutputBackend output) {
+
+  if (toFormat == dataFormat) {
+    aggregate_files<T, T>(fun, from, swapBytes, fromStride, fromRows, fromCols, fromNA,
+      to, toStride, toRows, toCols, toNA, xfact, yfact, naRm, output);
+  } else if (toFormat == "FLT8S" &&
+    (fun == AGGREGATE_MEAN || fun == AGGREGATE_SUM)) {
+    aggregate_files<T, double>(fun, from, swapBytes, fromStride, fromRows, fromCols, fromNA,
+      to, toStride, toRows, toCols, toNA, xfact, yfact, naRm, output);
+  } else {
+    Rcpp::stop("Can't aggregate %s data into %s", dataFormat, toFormat);
+  }
+}
+
+// Aggregates the file from, whose cells are in byteOrder ("little" or
+// "big"), into the file to, whose cells are in the host's byte order.
+// [[Rcpp::export]]
+void aggregate_files_numeric(
+    const std::string& from, int fromStride, int fromRows, int fromCols,
+    double fromNA,
+    const std::string& to, int toStride, int toRows, int toCols,
+    double toNA,
+    const std::string& dataFormat, const std::string& byteOrder,
+    const std::string& toFormat,
+    const std::string& fun, int xfact, int yfact, bool naRm,
+    const std::string& output) {
+
+  if (xfact <= 0 || yfact <= 0) {
+    Rcpp::stop("The aggregation factor must be positive");
+  }
+  OutputBackend backend;
+  if (!parseOutputBackend(output, &backend)) {
+    Rcpp::stop("Unknown output backend: %s", output);
+  }
+  bool swap;
+  if (!parseByteOrder(byteOrder, &swap)) {
+    Rcpp::stop("Unknown byte order: %s", byteOrder);
+  }
+
+  AggregateFun f;
+  if (fun == "mean") {
+    f = AGGREGATE_MEAN;
+  } else if (fun == "mode") {
+    f = AGGREGATE_MODE;
+  } else if (fun == "min") {
+    f = AGGREGATE_MIN;
+  } else if (fun == "max") {
+    f = AGGREGATE_MAX;
+  } else if (fun == "sum") {
+    f = AGGREGATE_SUM;
+  } else {
+    Rcpp::stop("Unknown aggregation function %s", fun);
+  }
+
+  if (dataFormat == "FLT8S") {
+    aggregate_files<double>(f, toFormat, dataFormat, from, swap, fromStride, fromRows, fromCols, fromNA, to, toStride, toRows, toCols, toNA, xfact, yfact, naRm, backend);
+  } else if (dataFormat == "FLT4S") {
+    aggregate_files<float>(f, toFormat, dataFormat, from, swap, fromStride, fromRows, fromCols, fromNA, to, toStride, toRows, toCols, toNA, xfact, yfact, naRm, backend);
+  } else if (dataFormat == "INT4U") {
+    aggregate_files<uint32_t>(f, toFormat, dataFormat, from, swap, fromStride, fromRows, fromCols, fromNA, to, toStride, toRows, toCols, toNA, xfact, yfact, naRm, backend);
+  } else if (dataFormat == "INT4S") {
+    aggregate_files<int32_t>(f, toFormat, dataFormat, from, swap, fromStride, fromRows, fromCols, fromNA, to, toStride, toRows, toCols, toNA, xfact, yfact, naRm, backend);
+  } else if (dataFormat == "INT2U") {
+    aggregate_files<uint16_t>(f, toFormat, dataFormat, from, swap, fromStride, fromRows, fromCols, fromNA, to, toStride, toRows, toCols, toNA, xfact, yfact, naRm, backend);
+  } else if (dataFormat == "INT2S") {
+    aggregate_files<int16_t>(f, toFormat, dataFormat, from, swap, fromStride, fromRows, fromCols, fromNA, to, toStride, toRows, toCols, toNA, xfact, yfact, naRm, backend);
+  } else if (dataFormat == "INT1U") {
+    aggregate_files<uint8_t>(f, toFormat, dataFormat, from, swap, fromStride, fromRows, fromCols, fromNA, to, toStride, toRows, toCols, toNA, xfact, yfact, naRm, backend);
+  } else if (dataFormat == "INT1S") {
+    aggregate_files<int8_t>(f, toFormat, dataFormat, from, swap, fromStride, fromRows, fromCols, fromNA, to, toStride, toRows, toCols, toNA, xfact, yfact, naRm, backend);
+  } else if (dataFormat == "LOG1S") {
+    if (sizeof(bool) != 1) {
+      Rcpp::stop("The size of 'bool' on your architecture is not 1 byte. Please report this issue to the rasterfaster author.");
+    }
+    aggregate_files<bool>(f, toFormat, dataFormat, from, swap, fromStride, fromRows, fromCols, fromNA, to, toStride, toRows, toCols, toNA, xfact, yfact, naRm, backend);
+  } else {
+    Rcpp::stop("Unknown data format: %s", dataFormat);
+  }
+}
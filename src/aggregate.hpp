@@ -1,105 +1,564 @@
+#ifndef AGGREGATE_HPP
+#define AGGREGATE_HPP
+
 #include <stdlib.h>
+#include <algorithm>
+#include <cstring>
 #include <limits>
 #include <vector>
 
+#include <boost/cstdint.hpp>
+#include <boost/math/special_functions/fpclassify.hpp>
+#include <boost/type_traits/integral_constant.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/unordered_set.hpp>
+#include <RcppParallel.h>
+
+#include "aggregate_kernels.hpp"
+
+// === MEAN =============================================================
+//
+// Values are summed in fixed blocks (in parallel), and the blocks' sums
+// added up in order, so the result doesn't depend on the number of
+// threads. See aggregate_kernels.hpp for the summing itself.
+
+// Values per block
+const size_t SUM_BLOCK_SIZE = 1 << 16;
+
+template <class TSum>
+class SumWorker : public RcppParallel::Worker {
+  const double* doubles;
+  const int32_t* ints;
+  size_t n;
+  TSum* sums;
+
+  void sum(size_t block, DoubleSum* out) {
+    size_t begin = block * SUM_BLOCK_SIZE;
+    doubleSumKernel(simdLevel())(doubles + begin,
+      std::min(SUM_BLOCK_SIZE, n - begin), out);
+  }
+  void sum(size_t block, IntSum* out) {
+    size_t begin = block * SUM_BLOCK_SIZE;
+    intSumKernel(simdLevel())(ints + begin, std::min(SUM_BLOCK_SIZE, n - begin), out);
+  }
+
+public:
+  SumWorker(const double* doubles, const int32_t* ints, size_t n, TSum* sums) :
+    doubles(doubles), ints(ints), n(n), sums(sums) {
+  }
+
+  // begin and end are block numbers
+  void operator()(std::size_t begin, std::size_t end) {
+    for (size_t block = begin; block < end; block++) {
+      sum(block, &sums[block]);
+    }
+  }
+};
+
+// Adds up the lanes of consecutive blocks' sums, in order, and their
+// missing values.
+inline double add_sums(const DoubleSum* sums, size_t blocks, size_t* missing) {
+  double sum = 0, comp = 0;
+  *missing = 0;
+  for (size_t block = 0; block < blocks; block++) {
+    for (size_t lane = 0; lane < SUM_LANES; lane++) {
+      neumaier_add(&sum, &comp, sums[block].sum[lane]);
+      comp += sums[block].comp[lane];
+    }
+    *missing += sums[block].missing;
+  }
+  // With infinite values, the compensation is meaningless (NaN)
+  return boost::math::isfinite(sum) ? sum + comp : sum;
+}
+
+// The sum of the non-NaN values, to within about one rounding of the exact
+// result; returns the number of NaN values (which include NA) in missing.
+inline double sum_values(const double* x, size_t n, size_t* missing) {
+  *missing = 0;
+  if (n == 0) {
+    return 0;
+  }
+  size_t blocks = (n + SUM_BLOCK_SIZE - 1) / SUM_BLOCK_SIZE;
+  std::vector<DoubleSum> sums(blocks);
+  SumWorker<DoubleSum> worker(x, NULL, n, &sums[0]);
+  RcppParallel::parallelFor(0, blocks, worker);
+
+  return add_sums(&sums[0], blocks, missing);
+}
+
+// The exact sum of the values other than NA_integer_, whose number is
+// returned in missing.
+inline int64_t sum_values(const int32_t* x, size_t n, size_t* missing) {
+  *missing = 0;
+  if (n == 0) {
+    return 0;
+  }
+  size_t blocks = (n + SUM_BLOCK_SIZE - 1) / SUM_BLOCK_SIZE;
+  std::vector<IntSum> sums(blocks);
+  SumWorker<IntSum> worker(NULL, x, n, &sums[0]);
+  RcppParallel::parallelFor(0, blocks, worker);
+
+  int64_t sum = 0;
+  for (size_t block = 0; block < blocks; block++) {
+    sum += sums[block].sum;
+    *missing += sums[block].missing;
+  }
+  return sum;
+}
+
+/**
+ * The mean of the values that aren't missing (NaN for doubles, NA_integer_
+ * for integers), or NaN if there are none.
+ *
+ * @param missing Receives the number of missing values.
+ */
+inline double mean(const double* begin, const double* end, size_t* missing) {
+  size_t n = end - begin;
+  // The compensated sum is accurate enough that, unlike R's mean(), there's
+  // nothing for a second pass over the differences from the mean to fix.
+  return sum_values(begin, n, missing) / (n - *missing);
+}
+
+inline double mean(const int32_t* begin, const int32_t* end, size_t* missing) {
+  size_t n = end - begin;
+  // The sum is exact, so only the conversion and division round
+  return static_cast<double>(sum_values(begin, n, missing)) / (n - *missing);
+}
+
+// === MODE =============================================================
+//
+// The mode is found by counting values: in a table with a bin per value
+// for small integer types (and for wider integers whose values span a
+// small range), in a hash table for other data with few distinct values,
+// and otherwise by sorting a copy. Ties are broken by a uniform random
+// number u in [0,1) supplied by the caller, which picks among the tied
+// values in ascending order; so results are reproducible, and mode() is
+// safe to call from several threads at once.
+
+// Inputs at least this long are counted in parallel, each thread counting
+// part of them, with the counts merged at the end.
+const size_t PARALLEL_MODE_THRESHOLD = 1 << 20;
+
+// How values are compared while counting. Doubles are compared by bit
+// pattern (with -0 taken as 0), so NA and NaN are each one value, like any
+// other, rather than unequal to everything.
 template <class T>
-double mean(T* begin, T* end) {
-  long double result = 0;
-  size_t length = end - begin;
+struct ModeKey {
+  typedef T type;
+  static type key(const T& value) { return value; }
+  static T value(const type& key) { return key; }
+};
 
-  for (; begin != end; begin++) {
-    result += static_cast<long double>(*begin) / length;
+template <>
+struct ModeKey<double> {
+  typedef uint64_t type;
+  static type key(double value) {
+    if (value == 0)
+      value = 0;
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
   }
+  static double value(type key) {
+    double value;
+    std::memcpy(&value, &key, sizeof(value));
+    return value;
+  }
+};
 
-  return result;
+// Which values are missing, and left out when naRm is true: NaN (including
+// NA) for doubles, and R's NA_integer_ for 32-bit integers.
+template <class T>
+struct MissingValue {
+  static bool test(const T& value) { return false; }
+};
+
+template <>
+struct MissingValue<double> {
+  static bool test(double value) { return value != value; }
+};
+
+template <>
+struct MissingValue<int32_t> {
+  static bool test(int32_t value) { return value == NA_INT32; }
+};
+
+// Integer types narrow enough to count in a table of every possible value
+template <class T>
+struct IsSmallInteger : boost::integral_constant<bool,
+  std::numeric_limits<T>::is_integer && sizeof(T) <= 2> {
+};
+
+// Picks one of the tied values (in ascending order of key) with u.
+template <class T>
+T pick_tie(const std::vector<typename ModeKey<T>::type>& ties, double u) {
+  size_t i = static_cast<size_t>(u * ties.size());
+  return ModeKey<T>::value(ties[std::min(i, ties.size() - 1)]);
 }
 
-template<>
-double mean(double* begin, double* end) {
-  long double result = 0;
-  size_t length = end - begin;
+// Counts integer values in [lo, hi], which all values must be in.
+template <class T>
+class RangeCounter {
+  int64_t _lo;
+  std::vector<size_t> _counts;
+
+public:
+  RangeCounter(int64_t lo, int64_t hi) : _lo(lo), _counts(hi - lo + 1) {
+  }
+
+  // An empty counter for the same range
+  RangeCounter like() const {
+    return RangeCounter(_lo, _lo + _counts.size() - 1);
+  }
 
-  for (double* p = begin; p != end; p++) {
-    result += static_cast<long double>(*p);
+  void add(T value) {
+    _counts[static_cast<int64_t>(value) - _lo]++;
   }
-  result /= length;
 
-  if (std::numeric_limits<long double>::infinity() != result) {
-    long double strip = 0;
-    for (double* p = begin; p != end; p++) {
-      strip += static_cast<long double>(*p) - result;
+  void merge(const RangeCounter& other) {
+    for (size_t i = 0; i < _counts.size(); i++) {
+      _counts[i] += other._counts[i];
     }
-    result += strip / length;
   }
 
-  return result;
+  void winners(std::vector<typename ModeKey<T>::type>* ties) const {
+    size_t maxCount = *std::max_element(_counts.begin(), _counts.end());
+    for (size_t i = 0; i < _counts.size(); i++) {
+      if (_counts[i] == maxCount) {
+        ties->push_back(static_cast<T>(_lo + static_cast<int64_t>(i)));
+      }
+    }
+  }
+};
+
+// Counts values of any type in a hash table.
+template <class T>
+class HashCounter {
+  typedef typename ModeKey<T>::type key_type;
+  typedef boost::unordered_map<key_type, size_t> map_type;
+  map_type _counts;
+
+public:
+  HashCounter like() const {
+    return HashCounter();
+  }
+
+  void add(T value) {
+    _counts[ModeKey<T>::key(value)]++;
+  }
+
+  void merge(const HashCounter& other) {
+    for (typename map_type::const_iterator it = other._counts.begin();
+      it != other._counts.end(); it++) {
+      _counts[it->first] += it->second;
+    }
+  }
+
+  void winners(std::vector<key_type>* ties) const {
+    size_t maxCount = 0;
+    for (typename map_type::const_iterator it = _counts.begin();
+      it != _counts.end(); it++) {
+      if (it->second > maxCount) {
+        maxCount = it->second;
+        ties->clear();
+      }
+      if (it->second == maxCount) {
+        ties->push_back(it->first);
+      }
+    }
+    // The order of a hash table depends on how it was filled
+    std::sort(ties->begin(), ties->end());
+  }
+};
+
+// Counts a range of values; for parallelReduce, so it can be split (each
+// part counting on its own) and joined.
+template <class T, class TCounter>
+class ModeCountWorker : public RcppParallel::Worker {
+  const T* values;
+  bool naRm;
+
+public:
+  TCounter counter;
+  // Number of values counted
+  size_t total;
+
+  ModeCountWorker(const T* values, bool naRm, const TCounter& counter) :
+    values(values), naRm(naRm), counter(counter), total(0) {
+  }
+
+  ModeCountWorker(const ModeCountWorker& other, RcppParallel::Split) :
+    values(other.values), naRm(other.naRm), counter(other.counter.like()),
+    total(0) {
+  }
+
+  void operator()(std::size_t begin, std::size_t end) {
+    for (size_t i = begin; i < end; i++) {
+      if (naRm && MissingValue<T>::test(values[i])) {
+        continue;
+      }
+      counter.add(values[i]);
+      total++;
+    }
+  }
+
+  void join(const ModeCountWorker& other) {
+    counter.merge(other.counter);
+    total += other.total;
+  }
+};
+
+template <class T, class TCounter>
+bool count_mode(const T* begin, const T* end, bool naRm,
+  const TCounter& counter, double u, T* result) {
+
+  size_t n = end - begin;
+  ModeCountWorker<T, TCounter> worker(begin, naRm, counter);
+  if (n >= PARALLEL_MODE_THRESHOLD) {
+    RcppParallel::parallelReduce(0, n, worker, PARALLEL_MODE_THRESHOLD / 4);
+  } else {
+    worker(0, n);
+  }
+  if (worker.total == 0) {
+    return false;
+  }
+
+  std::vector<typename ModeKey<T>::type> ties;
+  worker.counter.winners(&ties);
+  *result = pick_tie<T>(ties, u);
+  return true;
 }
 
+// Finds the mode by sorting a copy of the values; works for any type that
+// can be sorted, given iterators of any kind.
 template <class T, class TIter>
-bool mode(TIter begin, TIter end, T* result) {
-  if (begin == end) {
+bool sort_mode(TIter begin, TIter end, bool naRm, double u, T* result) {
+  typedef typename ModeKey<T>::type key_type;
+  std::vector<key_type> vec;
+  for (; begin != end; begin++) {
+    T value = *begin;
+    if (!naRm || !MissingValue<T>::test(value)) {
+      vec.push_back(ModeKey<T>::key(value));
+    }
+  }
+  if (vec.empty()) {
     // Can't take the mode of a zero values
     return false;
   }
-
-  // Copy the values into a vector we can mutate
-  std::vector<T> vec(begin, end);
-  // Sort the values
   std::sort(vec.begin(), vec.end());
 
-  // Now walk the sorted vector, looking for the longest run of equal values.
-  // If we have ties, pick a winner at random.
+  // Now walk the sorted vector, collecting the values of the longest runs
+  // of equal values.
+  std::vector<key_type> ties;
+  size_t maxCount = 0;
+  for (size_t runStart = 0; runStart < vec.size(); ) {
+    size_t runEnd = runStart + 1;
+    while (runEnd < vec.size() && vec[runEnd] == vec[runStart]) {
+      runEnd++;
+    }
+    size_t count = runEnd - runStart;
+    if (count > maxCount) {
+      maxCount = count;
+      ties.clear();
+    }
+    if (count == maxCount) {
+      ties.push_back(vec[runStart]);
+    }
+    runStart = runEnd;
+  }
 
-  typename std::vector<T>::const_iterator prev = vec.begin(),
-    pos = vec.begin();
-  pos++;
+  *result = pick_tie<T>(ties, u);
+  return true;
+}
 
-  // Number of consecutive times we've seen the value of *prev
-  size_t currCount = 1;
-  // Maximum value of currCount
-  size_t maxCount = 0;
-  // Number of times we've tied
-  size_t ties = 0;
-
-  for (; pos != vec.end(); pos++, prev++, currCount++) {
-    if (*pos != *prev) {
-      // The value changed. Is it tied with the winner?
-      bool winner = false;
-      if (currCount == maxCount) {
-        ties++;
-        // With each additional tie (at the same count), the chance of the new
-        // value being the winner should go down, so that overall the chances
-        // are equal for any winner at the same count.
-        if (::rand() % (ties + 1) == 0) {
-          winner = true;
-        }
-      } else if (currCount > maxCount) {
-        // We've exceeded all past winners. Not only are we the winner, there's
-        // also never been a tie with this count.
-        winner = true;
-        ties = 0;
-      }
+// Guesses whether values have few enough distinct values that counting
+// them in a hash table beats sorting, from a sample of up to 1024 of them.
+template <class T>
+bool few_distinct_values(const T* begin, const T* end) {
+  size_t n = end - begin;
+  size_t samples = std::min(n, static_cast<size_t>(1024));
+  boost::unordered_set<typename ModeKey<T>::type> distinct;
+  for (size_t i = 0; i < samples; i++) {
+    distinct.insert(ModeKey<T>::key(begin[i * n / samples]));
+  }
+  return distinct.size() * 4 <= samples;
+}
+
+// Small integers: count every possible value
+template <class T>
+bool mode(const T* begin, const T* end, bool naRm, double u, T* result,
+  boost::true_type) {
+  return count_mode(begin, end, naRm, RangeCounter<T>(
+    std::numeric_limits<T>::min(), std::numeric_limits<T>::max()), u, result);
+}
 
-      // The *prev value is the winner; set the maxCount, then reset the
-      // currCount for the next value.
-      if (winner) {
-        maxCount = currCount;
-        *result = *prev;
+// Anything else
+template <class T>
+bool mode(const T* begin, const T* end, bool naRm, double u, T* result,
+  boost::false_type) {
+  size_t n = end - begin;
+  if (std::numeric_limits<T>::is_integer) {
+    // A table is still best if the values span a small range (relative to
+    // their number, with a cap, as each thread gets its own table)
+    bool any = false;
+    T lo = 0, hi = 0;
+    for (const T* p = begin; p != end; p++) {
+      if (naRm && MissingValue<T>::test(*p)) {
+        continue;
       }
+      if (!any || *p < lo)
+        lo = *p;
+      if (!any || *p > hi)
+        hi = *p;
+      any = true;
+    }
+    if (!any) {
+      return false;
+    }
+    double range = static_cast<double>(hi) - static_cast<double>(lo) + 1;
+    if (range <= 65536 || (range <= n / 4 && range <= (1 << 22))) {
+      return count_mode(begin, end, naRm, RangeCounter<T>(lo, hi), u, result);
+    }
+  }
+  if (n > 0 && few_distinct_values(begin, end)) {
+    return count_mode(begin, end, naRm, HashCounter<T>(), u, result);
+  }
+  return sort_mode(begin, end, naRm, u, result);
+}
+
+/**
+ * Find the most common of a range of values.
+ *
+ * @param naRm If true, missing values (see MissingValue) are left out.
+ * @param u A uniform random number in [0,1), which picks the result if
+ *   several values are equally common.
+ * @return false if there are no values.
+ */
+template <class T>
+bool mode(const T* begin, const T* end, bool naRm, double u, T* result) {
+  return mode(begin, end, naRm, u, result, IsSmallInteger<T>());
+}
+
+// Finds the modes of many small windows of values one after another (for
+// example, the cells that aggregate into one), reusing its scratch space
+// rather than allocating for every window. Add a window's values with
+// add(), then call result(), which also starts the next window.
+template <class T, bool Small = IsSmallInteger<T>::value>
+class WindowMode;
 
-      // Regardless of whether we were the winner or not, reset the count.
-      currCount = 0;
+// Small integers: counted in a table of every possible value. Only the
+// bins of the window's values are read back and cleared, so the table's
+// size doesn't matter.
+template <class T>
+class WindowMode<T, true> {
+  std::vector<uint32_t> _counts;
+  std::vector<T> _values;
+  std::vector<T> _ties;
+  size_t _n;
+  uint32_t _maxCount;
+
+  static size_t bin(T value) {
+    return static_cast<int64_t>(value) - std::numeric_limits<T>::min();
+  }
+
+public:
+  // maxValues is the most values a window can have
+  WindowMode(size_t maxValues) :
+    _counts(maxValues == 0 ? 0 : static_cast<size_t>(std::numeric_limits<T>::max()) -
+      std::numeric_limits<T>::min() + 1), _values(maxValues), _n(0),
+    _maxCount(0) {
+    _ties.reserve(maxValues);
+  }
+
+  void add(T value) {
+    _values[_n++] = value;
+    _maxCount = std::max(_maxCount, ++_counts[bin(value)]);
+  }
+
+  bool result(double u, T* result) {
+    if (_n == 0) {
+      return false;
     }
+    uint32_t maxCount = _maxCount;
+    _maxCount = 0;
+    // Clearing each bin as it's read also keeps ties from being repeated
+    _ties.clear();
+    for (size_t i = 0; i < _n; i++) {
+      uint32_t& count = _counts[bin(_values[i])];
+      if (count == maxCount) {
+        _ties.push_back(_values[i]);
+      }
+      count = 0;
+    }
+    std::sort(_ties.begin(), _ties.end());
+    *result = pick_tie<T>(_ties, u);
+    _n = 0;
+    return true;
+  }
+};
+
+// Anything else: the window's values are sorted in place.
+template <class T>
+class WindowMode<T, false> {
+  typedef typename ModeKey<T>::type key_type;
+  std::vector<key_type> _keys;
+  size_t _n;
+
+public:
+  WindowMode(size_t maxValues) : _keys(maxValues), _n(0) {
   }
 
-  if (currCount == maxCount) {
-    ties++;
-    if (::rand() % (ties + 1) == 0) {
-      *result = *prev;
+  void add(T value) {
+    _keys[_n++] = ModeKey<T>::key(value);
+  }
+
+  bool result(double u, T* result) {
+    if (_n == 0) {
+      return false;
     }
-  } else if (currCount > maxCount) {
-    *result = *prev;
+    typename std::vector<key_type>::iterator begin = _keys.begin(),
+      end = _keys.begin() + _n;
+    std::sort(begin, end);
+
+    // Find the length and number of the longest runs, then go back for the
+    // one that u picks
+    size_t maxCount = 0, ties = 0;
+    for (typename std::vector<key_type>::iterator run = begin; run != end; ) {
+      typename std::vector<key_type>::iterator runEnd = std::upper_bound(run, end, *run);
+      size_t count = runEnd - run;
+      if (count > maxCount) {
+        maxCount = count;
+        ties = 0;
+      }
+      if (count == maxCount) {
+        ties++;
+      }
+      run = runEnd;
+    }
+    size_t pick = std::min(static_cast<size_t>(u * ties), ties - 1);
+    for (typename std::vector<key_type>::iterator run = begin; run != end; ) {
+      typename std::vector<key_type>::iterator runEnd = std::upper_bound(run, end, *run);
+      if (static_cast<size_t>(runEnd - run) == maxCount && pick-- == 0) {
+        *result = ModeKey<T>::value(*run);
+        break;
+      }
+      run = runEnd;
+    }
+    _n = 0;
+    return true;
   }
+};
 
-  return true;
+// A uniform number in [0,1) determined by seed and i (with SplitMix64's
+// mixing function), for breaking the ties of many modes reproducibly
+// without sharing a random number generator between threads.
+inline double hash_uniform(uint64_t seed, uint64_t i) {
+  uint64_t z = seed + (i + 1) * UINT64_C(0x9E3779B97F4A7C15);
+  z = (z ^ (z >> 30)) * UINT64_C(0xBF58476D1CE4E5B9);
+  z = (z ^ (z >> 27)) * UINT64_C(0x94D049BB133111EB);
+  z ^= z >> 31;
+  // The top 53 bits, as a double
+  return (z >> 11) * (1.0 / (UINT64_C(1) << 53));
 }
+
+#endif
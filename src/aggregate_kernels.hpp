@@ -0,0 +1,161 @@
+#ifndef AGGREGATE_KERNELS_HPP
+#define AGGREGATE_KERNELS_HPP
+
+#include <cmath>
+#include <limits>
+
+#include <boost/cstdint.hpp>
+
+#include "simd.hpp"
+
+#ifdef RASTERFASTER_X86_SIMD
+#include <immintrin.h>
+#endif
+
+// Summing kernels for means. Doubles are summed with Neumaier's compensated
+// summation in SUM_LANES interleaved lanes (value i goes to lane i %
+// SUM_LANES), so that the vectorized kernels can keep one lane per SIMD
+// lane; the scalar kernel keeps the same lanes and does the same operations
+// in the same order, so every instruction set gives bit-for-bit the same
+// sums. Integers are summed exactly, in 64 bits.
+//
+// Missing values (NaN, which includes R's NA_real_, and NA_integer_) are
+// counted and left out of the sums.
+
+const size_t SUM_LANES = 4;
+
+// R's NA_integer_
+const int32_t NA_INT32 = std::numeric_limits<int32_t>::min();
+
+struct DoubleSum {
+  double sum[SUM_LANES], comp[SUM_LANES];
+  size_t missing;
+};
+
+struct IntSum {
+  int64_t sum;
+  size_t missing;
+};
+
+// Adds value to sum, accumulating the rounding error in comp
+inline void neumaier_add(double* sum, double* comp, double value) {
+  double t = *sum + value;
+  if (std::fabs(*sum) >= std::fabs(value))
+    *comp += (*sum - t) + value;
+  else
+    *comp += (value - t) + *sum;
+  *sum = t;
+}
+
+inline void sum_doubles_scalar(const double* x, size_t n, DoubleSum* out) {
+  for (size_t lane = 0; lane < SUM_LANES; lane++) {
+    out->sum[lane] = 0;
+    out->comp[lane] = 0;
+  }
+  out->missing = 0;
+  for (size_t i = 0; i < n; i++) {
+    double value = x[i];
+    // Missing values are added as zeros, as in the vectorized kernels
+    if (value != value) {
+      out->missing++;
+      value = 0;
+    }
+    neumaier_add(&out->sum[i % SUM_LANES], &out->comp[i % SUM_LANES], value);
+  }
+}
+
+inline void sum_ints_scalar(const int32_t* x, size_t n, IntSum* out) {
+  int64_t sum = 0;
+  size_t missing = 0;
+  for (size_t i = 0; i < n; i++) {
+    bool isNA = x[i] == NA_INT32;
+    missing += isNA;
+    sum += isNA ? 0 : x[i];
+  }
+  out->sum = sum;
+  out->missing = missing;
+}
+
+#ifdef RASTERFASTER_X86_SIMD
+
+// --- AVX2: one compensated sum per double lane; 8 integers at a time ---
+
+RF_AVX2 inline void sum_doubles_avx2(const double* x, size_t n, DoubleSum* out) {
+  const __m256d signBit = _mm256_set1_pd(-0.0);
+  __m256d sum = _mm256_setzero_pd(), comp = _mm256_setzero_pd();
+  size_t missing = 0;
+  size_t i = 0;
+  for (; i + SUM_LANES <= n; i += SUM_LANES) {
+    __m256d v = _mm256_loadu_pd(x + i);
+    __m256d isNaN = _mm256_cmp_pd(v, v, _CMP_UNORD_Q);
+    missing += __builtin_popcount(_mm256_movemask_pd(isNaN));
+    v = _mm256_andnot_pd(isNaN, v);
+
+    __m256d t = _mm256_add_pd(sum, v);
+    __m256d sumBigger = _mm256_cmp_pd(_mm256_andnot_pd(signBit, sum),
+      _mm256_andnot_pd(signBit, v), _CMP_GE_OQ);
+    __m256d ifSum = _mm256_add_pd(_mm256_sub_pd(sum, t), v);
+    __m256d ifValue = _mm256_add_pd(_mm256_sub_pd(v, t), sum);
+    comp = _mm256_add_pd(comp, _mm256_blendv_pd(ifValue, ifSum, sumBigger));
+    sum = t;
+  }
+  _mm256_storeu_pd(out->sum, sum);
+  _mm256_storeu_pd(out->comp, comp);
+  // The rest of the values continue the same lanes
+  for (; i < n; i++) {
+    double value = x[i];
+    if (value != value) {
+      missing++;
+      value = 0;
+    }
+    neumaier_add(&out->sum[i % SUM_LANES], &out->comp[i % SUM_LANES], value);
+  }
+  out->missing = missing;
+}
+
+RF_AVX2 inline void sum_ints_avx2(const int32_t* x, size_t n, IntSum* out) {
+  const __m256i na = _mm256_set1_epi32(NA_INT32);
+  __m256i sum = _mm256_setzero_si256();
+  size_t missing = 0;
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(x + i));
+    __m256i isNA = _mm256_cmpeq_epi32(v, na);
+    missing += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(isNA)));
+    v = _mm256_andnot_si256(isNA, v);
+    sum = _mm256_add_epi64(sum, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(v)));
+    sum = _mm256_add_epi64(sum, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(v, 1)));
+  }
+  int64_t lanes[4];
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), sum);
+  IntSum rest;
+  sum_ints_scalar(x + i, n - i, &rest);
+  out->sum = lanes[0] + lanes[1] + lanes[2] + lanes[3] + rest.sum;
+  out->missing = missing + rest.missing;
+}
+
+#endif // RASTERFASTER_X86_SIMD
+
+typedef void (*DoubleSumKernel)(const double* x, size_t n, DoubleSum* out);
+typedef void (*IntSumKernel)(const int32_t* x, size_t n, IntSum* out);
+
+// Summing is limited by memory bandwidth well before AVX-512 could help,
+// and two-lane SSE4.2 kernels gain little over the scalar ones; so only
+// AVX2 gets vectorized kernels.
+inline DoubleSumKernel doubleSumKernel(SimdLevel level) {
+#ifdef RASTERFASTER_X86_SIMD
+  if (level >= SIMD_AVX2)
+    return &sum_doubles_avx2;
+#endif
+  return &sum_doubles_scalar;
+}
+
+inline IntSumKernel intSumKernel(SimdLevel level) {
+#ifdef RASTERFASTER_X86_SIMD
+  if (level >= SIMD_AVX2)
+    return &sum_ints_avx2;
+#endif
+  return &sum_ints_scalar;
+}
+
+#endif
@@ -0,0 +1,171 @@
+#ifndef BYTESWAP_HPP
+#define BYTESWAP_HPP
+
+#include <cstring>
+#include <string>
+
+#include <boost/cstdint.hpp>
+
+#include "simd.hpp"
+
+#ifdef RASTERFASTER_X86_SIMD
+#include <immintrin.h>
+#endif
+
+// A .grd header records the byte order its .gri file was written in
+// ("little" or "big"). Cells of a file in the other byte order than the
+// host's have their bytes reversed as they're read, either one at a time
+// (swap_bytes) or a run at a time (see ByteSwapKernel).
+
+inline bool hostIsBigEndian() {
+  const uint16_t one = 1;
+  unsigned char first;
+  std::memcpy(&first, &one, 1);
+  return first == 0;
+}
+
+// Parses a byte order name, and sets swap to whether cells stored in that
+// order have to be swapped on this host. Returns false if the name is
+// unknown.
+inline bool parseByteOrder(const std::string& name, bool* swap) {
+  if (name == "little") *swap = hostIsBigEndian();
+  else if (name == "big") *swap = !hostIsBigEndian();
+  else return false;
+  return true;
+}
+
+// The unsigned word of each cell size, and how to reverse its bytes
+template <size_t N>
+struct ByteWord;
+
+template <>
+struct ByteWord<1> {
+  typedef uint8_t type;
+  static type swap(type x) { return x; }
+};
+
+template <>
+struct ByteWord<2> {
+  typedef uint16_t type;
+  static type swap(type x) { return static_cast<type>((x >> 8) | (x << 8)); }
+};
+
+template <>
+struct ByteWord<4> {
+  typedef uint32_t type;
+  static type swap(type x) {
+    return (x >> 24) | ((x >> 8) & 0xff00) | ((x << 8) & 0xff0000) | (x << 24);
+  }
+};
+
+template <>
+struct ByteWord<8> {
+  typedef uint64_t type;
+  static type swap(type x) {
+    return (static_cast<type>(ByteWord<4>::swap(static_cast<uint32_t>(x))) << 32) |
+      ByteWord<4>::swap(static_cast<uint32_t>(x >> 32));
+  }
+};
+
+// value with its bytes reversed
+template <class T>
+inline T swap_bytes(T value) {
+  typedef ByteWord<sizeof(T)> word;
+  typename word::type w;
+  std::memcpy(&w, &value, sizeof(T));
+  w = word::swap(w);
+  std::memcpy(&value, &w, sizeof(T));
+  return value;
+}
+
+// Copies n cells from src to dst, reversing the bytes of each. dst may be
+// src, but mustn't overlap it otherwise.
+typedef void (*ByteSwapKernel)(const void* src, void* dst, size_t n);
+
+template <size_t N>
+void swap_bytes_scalar(const void* src, void* dst, size_t n) {
+  const char* s = static_cast<const char*>(src);
+  char* d = static_cast<char*>(dst);
+  for (size_t i = 0; i < n; i++) {
+    typename ByteWord<N>::type w;
+    std::memcpy(&w, s + i * N, N);
+    w = ByteWord<N>::swap(w);
+    std::memcpy(d + i * N, &w, N);
+  }
+}
+
+#ifdef RASTERFASTER_X86_SIMD
+
+// The shuffle that reverses each N-byte cell within 16 bytes; cells never
+// straddle the 128-bit lanes, so AVX2's per-lane shuffle uses it twice.
+template <size_t N>
+inline void byte_swap_mask(char* mask) {
+  for (size_t j = 0; j < 16; j++) {
+    mask[j] = static_cast<char>(j / N * N + (N - 1 - j % N));
+  }
+}
+
+template <size_t N>
+RF_SSE42 void swap_bytes_sse42(const void* src, void* dst, size_t n) {
+  char m[16];
+  byte_swap_mask<N>(m);
+  const __m128i mask = _mm_loadu_si128(reinterpret_cast<const __m128i*>(m));
+  const char* s = static_cast<const char*>(src);
+  char* d = static_cast<char*>(dst);
+  size_t bytes = n * N, i = 0;
+  for (; i + 32 <= bytes; i += 32) {
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i + 16));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(d + i), _mm_shuffle_epi8(a, mask));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(d + i + 16), _mm_shuffle_epi8(b, mask));
+  }
+  for (; i + 16 <= bytes; i += 16) {
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(d + i), _mm_shuffle_epi8(a, mask));
+  }
+  swap_bytes_scalar<N>(s + i, d + i, (bytes - i) / N);
+}
+
+template <size_t N>
+RF_AVX2 void swap_bytes_avx2(const void* src, void* dst, size_t n) {
+  char m[16];
+  byte_swap_mask<N>(m);
+  const __m256i mask = _mm256_broadcastsi128_si256(
+    _mm_loadu_si128(reinterpret_cast<const __m128i*>(m)));
+  const char* s = static_cast<const char*>(src);
+  char* d = static_cast<char*>(dst);
+  size_t bytes = n * N, i = 0;
+  for (; i + 64 <= bytes; i += 64) {
+    __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i));
+    __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i + 32));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(d + i), _mm256_shuffle_epi8(a, mask));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(d + i + 32), _mm256_shuffle_epi8(b, mask));
+  }
+  // Short runs are common (a block's columns of a row), so the tail is
+  // done 16 bytes at a time too
+  for (; i + 16 <= bytes; i += 16) {
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(d + i),
+      _mm_shuffle_epi8(a, _mm256_castsi256_si128(mask)));
+  }
+  swap_bytes_scalar<N>(s + i, d + i, (bytes - i) / N);
+}
+
+#endif
+
+// AVX-512F has no byte shuffle (that needs AVX-512BW), so AVX2's kernels are
+// used there too.
+template <class T>
+ByteSwapKernel byteSwapKernel(SimdLevel level) {
+#ifdef RASTERFASTER_X86_SIMD
+  if (sizeof(T) > 1) {
+    if (level >= SIMD_AVX2)
+      return &swap_bytes_avx2<sizeof(T)>;
+    if (level >= SIMD_SSE42)
+      return &swap_bytes_sse42<sizeof(T)>;
+  }
+#endif
+  return &swap_bytes_scalar<sizeof(T)>;
+}
+
+#endif
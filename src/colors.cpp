@@ -2,9 +2,9 @@
 // [[Rcpp::depends(RcppParallel)]]
 #include <RcppParallel.h>
 
-#include <iomanip>
-#include <sstream>
-#include <iostream>
+#include <boost/unordered_map.hpp>
+
+#include "colors.hpp"
 
 using namespace Rcpp;
 using namespace RcppParallel;
@@ -16,245 +16,183 @@ void intToHex(unsigned int x, char* buf) {
   buf[1] = hexchars[x & 0xF];
 }
 
-// Convert the rgb values to #RRGGBB hex string
-std::string rgbcolor(double r, double g, double b) {
-  char color[8];
-  color[0] = '#';
-  intToHex(static_cast<unsigned int>(r), color + 1);
-  intToHex(static_cast<unsigned int>(g), color + 3);
-  intToHex(static_cast<unsigned int>(b), color + 5);
-  color[7] = 0;
-  return std::string(color);
-}
-
-// Convert the rgba values to #RRGGBB hex string
-std::string rgbacolor(double r, double g, double b, double a) {
-  char color[10];
-  color[0] = '#';
-  intToHex(static_cast<unsigned int>(r), color + 1);
-  intToHex(static_cast<unsigned int>(g), color + 3);
-  intToHex(static_cast<unsigned int>(b), color + 5);
-  intToHex(static_cast<unsigned int>(a), color + 7);
-  color[9] = 0;
-  return std::string(color);
-}
-
-
-// === BEGIN SRGB/LAB CONVERSION =======================================
-
-double linear2srgb(double c) {
-  double a = 0.055;
-  if (c <= 0.0031308) {
-    return 12.92 * c;
-  } else {
-    return (1 + a) * ::pow(c, 1.0/2.4) - a;
+// Write a packed color as "#RRGGBB" (or "#RRGGBBAA" if alpha) to buf, which
+// must have room for 9 characters; returns the number written.
+int formatColor(uint32_t color, bool alpha, char* buf) {
+  unsigned char rgba[4];
+  unpackRGBA(color, rgba);
+  buf[0] = '#';
+  intToHex(rgba[0], buf + 1);
+  intToHex(rgba[1], buf + 3);
+  intToHex(rgba[2], buf + 5);
+  if (!alpha) {
+    return 7;
   }
+  intToHex(rgba[3], buf + 7);
+  return 9;
 }
 
-double srgb2linear(double c) {
-  double a = 0.055;
-  if (c <= 0.04045) {
-    return c / 12.92;
-  } else {
-    return ::pow((c + a) / (1 + a), 2.4);
+// The ColorRamp behind an external pointer made by makeColorRamp
+const ColorRamp& getColorRamp(SEXP ramp) {
+  XPtr<ColorRamp> pRamp(ramp);
+  if (!pRamp.get()) {
+    stop("Invalid color ramp");
   }
+  return *pRamp;
 }
 
-double d65_x = 0.95320571254937703;
-double d65_y = 1.0;
-double d65_z = 1.08538438164691575;
-
-double srgb_xyz[][3] = {
-  {0.416821341885317054, 0.35657671707797467, 0.179807653586085414},
-  {0.214923504409616606, 0.71315343415594934, 0.071923061434434166},
-  {0.019538500400874251, 0.11885890569265833, 0.946986975553383292}
-};
-
-void srgb2xyz(double r, double g, double b, double* x, double *y, double* z) {
-  r = srgb2linear(r);
-  g = srgb2linear(g);
-  b = srgb2linear(b);
-  *x = srgb_xyz[0][0] * r + srgb_xyz[0][1] * g + srgb_xyz[0][2] * b;
-  *y = srgb_xyz[1][0] * r + srgb_xyz[1][1] * g + srgb_xyz[1][2] * b;
-  *z = srgb_xyz[2][0] * r + srgb_xyz[2][1] * g + srgb_xyz[2][2] * b;
-}
-
-double xyz_srgb[][3] = {
-  { 3.206520517144463067, -1.52104178377365540, -0.493310848791455814},
-  {-0.971982546201231923,  1.88126865160848711,  0.041672484599589298},
-  { 0.055838338593097898, -0.20474057484135894,  1.060928433268858884}
-};
-
-void xyz2srgb(double x, double y, double z, double *r, double *g, double *b) {
-  *r = xyz_srgb[0][0] * x + xyz_srgb[0][1] * y + xyz_srgb[0][2] * z;
-  *g = xyz_srgb[1][0] * x + xyz_srgb[1][1] * y + xyz_srgb[1][2] * z;
-  *b = xyz_srgb[2][0] * x + xyz_srgb[2][1] * y + xyz_srgb[2][2] * z;
-  *r = linear2srgb(*r);
-  *g = linear2srgb(*g);
-  *b = linear2srgb(*b);
-}
+// Colors x into packed (nativeRaster) colors. x is column-major with nrow
+// rows, like an R matrix; the result is row-major, like a nativeRaster.
+// Values without a color get naColor and, if isNA is given, are flagged in it.
+class PackedColorRampWorker : public RcppParallel::Worker {
+  const ColorRamp* pRamp;
+  const RVector<double> x;
+  const uint32_t naColor;
+  const size_t nrow, ncol;
+  uint32_t* result;
+  char* isNA;
 
-double labf(double t) {
-  if (t > ::pow(6.0 / 29.0, 3.0)) {
-    return ::pow(t, 1.0 / 3.0);
-  } else {
-    return 1.0/3.0 * ::pow(29.0 / 6.0, 2.0) * t + (4.0 / 29.0);
+public:
+  PackedColorRampWorker(const ColorRamp* pRamp, const RVector<double> x,
+    uint32_t naColor, size_t nrow, uint32_t* result, char* isNA = NULL)
+    : pRamp(pRamp), x(x), naColor(naColor), nrow(nrow), ncol(x.length() / nrow),
+      result(result), isNA(isNA) {
   }
-}
-
-void xyz2lab(double x, double y, double z, double *l, double *a, double *b) {
-  x = x / d65_x;
-  y = y / d65_y;
-  z = z / d65_z;
-  *l = 116.0 * labf(y) - 16.0;
-  *a = 500.0 * (labf(x) - labf(y));
-  *b = 200.0 * (labf(y) - labf(z));
-}
 
-double labf_inv(double t) {
-  if (t > 6.0 / 29.0) {
-    return ::pow(t, 3.0);
-  } else {
-    return 3 * ::pow(6.0/29.0, 2) * (t - 4.0 / 29.0);
+  // begin and end are row numbers
+  void operator()(std::size_t begin, std::size_t end) {
+    if (ncol == 1) {
+      // A vector: the rows are contiguous in both x and result
+      pRamp->packed(x.begin() + begin, 1, end - begin, naColor, result + begin,
+        isNA ? isNA + begin : NULL);
+      return;
+    }
+    for (size_t row = begin; row < end; row++) {
+      pRamp->packed(x.begin() + row, nrow, ncol, naColor, result + row * ncol,
+        isNA ? isNA + row * ncol : NULL);
+    }
   }
-}
+};
 
-void lab2xyz(double l, double a, double b, double *x, double *y, double *z) {
-  *y = d65_y * labf_inv(1.0 / 116.0 * (l + 16.0));
-  *x = d65_x * labf_inv(1.0 / 116.0 * (l + 16.0) + 1.0 / 500.0 * a);
-  *z = d65_z * labf_inv(1.0 / 116.0 * (l + 16.0) - 1.0 / 200.0 * b);
+// Creates a color ramp from a col2rgb() matrix. If resolution is at least 2,
+// that many colors are precomputed and each value gets the nearest of them;
+// otherwise every color is computed exactly.
+// [[Rcpp::export]]
+SEXP makeColorRamp(NumericMatrix colors, bool alpha, int resolution) {
+  if (colors.nrow() != (alpha ? 4 : 3)) {
+    stop("colors must have one row per channel");
+  }
+  return XPtr<ColorRamp>(new ColorRamp(colors.begin(), colors.ncol(), alpha,
+    std::max(resolution, 0)), true);
 }
 
-void srgb2lab(double red, double green, double blue, double *l, double *a, double *b) {
-  double x, y, z;
-  srgb2xyz(red, green, blue, &x, &y, &z);
-  xyz2lab(x, y, z, l, a, b);
-}
-void lab2srgb(double l, double a, double b, double *red, double *green, double *blue) {
-  double x, y, z;
-  lab2xyz(l, a, b, &x, &y, &z);
-  xyz2srgb(x, y, z, red, green, blue);
+// Whether ramp still points at a ColorRamp (external pointers don't survive
+// serialization).
+// [[Rcpp::export]]
+bool colorRampIsValid(SEXP ramp) {
+  return TYPEOF(ramp) == EXTPTRSXP && R_ExternalPtrAddr(ramp) != NULL;
 }
 
-// === END SRGB/LAB CONVERSION =======================================
-
-
-class ColorRampWorker : public RcppParallel::Worker {
-  // inputs
-  const RMatrix<double> colors;
-  const RVector<double> x;
-  const bool alpha;
-  const size_t ncolors;
-
-public:
-  // output
-  tbb::concurrent_vector<std::string> result;
-
-  ColorRampWorker(const RMatrix<double> colors, const RVector<double> x, bool alpha)
-    : colors(colors), x(x), alpha(alpha), ncolors(colors.ncol()), result(x.length()) {
+// Colors are computed in parallel into a flat buffer of packed colors; only
+// then are they turned into strings, on this thread, making one CHARSXP per
+// distinct color rather than one std::string per value.
+// [[Rcpp::export]]
+StringVector doColorRamp(SEXP ramp, NumericVector x, std::string naColor) {
+  const ColorRamp& colorRamp = getColorRamp(ramp);
+  size_t n = x.size();
+  StringVector result(n);
+  if (n == 0) {
+    return result;
   }
 
-  void operator()(std::size_t begin, std::size_t end) {
-    for (size_t i = begin; i < end; i++) {
-      double xval = x[i];
-      if (xval < 0 || xval > 1 || R_IsNA(xval)) {
-        // Illegal or NA value for this x value. We can't use NA here but "" will
-        // be replaced with NA later, when we're back on the R thread.
-        result[i] = std::string();
+  std::vector<uint32_t> colors(n);
+  std::vector<char> isNA(n);
+  PackedColorRampWorker worker(&colorRamp, RVector<double>(x), 0, n,
+    &colors[0], &isNA[0]);
+  parallelFor(0, n, worker, 4096);
+
+  Shield<SEXP> naChar(naColor.empty() ? NA_STRING : Rf_mkChar(naColor.c_str()));
+  boost::unordered_map<uint32_t, SEXP> chars;
+  bool alpha = colorRamp.alpha();
+  // Neighboring values often have the same color, so check the last one
+  // before the map
+  uint32_t lastColor = 0;
+  SEXP lastChar = NULL;
+  for (size_t i = 0; i < n; i++) {
+    if (isNA[i]) {
+      SET_STRING_ELT(result, i, naChar);
+      continue;
+    }
+    uint32_t color = colors[i];
+    if (lastChar == NULL || color != lastColor) {
+      boost::unordered_map<uint32_t, SEXP>::iterator it = chars.find(color);
+      if (it != chars.end()) {
+        lastChar = it->second;
       } else {
-        // Scale the [0,1] value to [0,n-1]
-        xval *= ncolors - 1;
-        // Find the closest color that's *lower* than xval. This'll be one of the
-        // colors we use to interpolate; the other will be colorOffset+1.
-        size_t colorOffset = static_cast<size_t>(::floor(xval));
-        double l, a, b;
-        double opacity = 0;
-        if (colorOffset == ncolors - 1) {
-          // xvalue is exactly at the top of the range. Just use the top color.
-          l = colors(0, colorOffset);
-          a = colors(1, colorOffset);
-          b = colors(2, colorOffset);
-          if (alpha) {
-            opacity = colors(3, colorOffset);
-          }
-        } else {
-          // Do a linear interp between the two closest colors.
-          double factorB = xval - colorOffset;
-          double factorA = 1 - factorB;
-          l = factorA * colors(0, colorOffset) + factorB * colors(0, colorOffset + 1);
-          a = factorA * colors(1, colorOffset) + factorB * colors(1, colorOffset + 1);
-          b = factorA * colors(2, colorOffset) + factorB * colors(2, colorOffset + 1);
-          if (alpha) {
-            opacity = ::round(factorA * colors(3, colorOffset) + factorB * colors(3, colorOffset + 1));
-          }
-        }
-
-        double red, green, blue;
-        lab2srgb(l, a, b, &red, &green, &blue);
-        red = std::max(0.0, std::min(255.0, ::round(red * 255)));
-        green = std::max(0.0, std::min(255.0, ::round(green * 255)));
-        blue = std::max(0.0, std::min(255.0, ::round(blue * 255)));
-
-        // Convert the result to hex string
-        if (!alpha)
-          result[i] = rgbcolor(red, green, blue);
-        else
-          result[i] = rgbacolor(red, green, blue, opacity);
+        char buf[9];
+        // Stays protected by being in result
+        lastChar = Rf_mkCharLen(buf, formatColor(color, alpha, buf));
+        chars[color] = lastChar;
       }
+      lastColor = color;
     }
-  }
-};
-
-StringVector doColorRampParallel(NumericMatrix colors, NumericVector x, bool alpha, std::string naColor) {
-  // We can't use normal Rcpp data structures on other threads, so use
-  // RcppParallel-provided matrix and vector classes instead.
-  RMatrix<double> rcolors(colors);
-  RVector<double> rx(x);
-  ColorRampWorker crw(rcolors, rx, alpha);
-  parallelFor(0, x.size(), crw);
-
-  // Copy the results from ColorRampWorker's tbb::concurrent_vector<std::string>
-  // to a StringVector that's suitable for returning to R.
-  // TODO: Is there a way to speed this up or do fewer allocations? Last I
-  //   checked we're now spending 50% of our time in this loop.
-  StringVector result(x.length());
-  for (size_t i = 0; i < x.length(); i++) {
-    if (crw.result[i].empty()) {
-      if (naColor.empty())
-        result[i] = NA_STRING;
-      else
-        result[i] = naColor;
-    } else {
-      result[i] = crw.result[i];
-    }
+    SET_STRING_ELT(result, i, lastChar);
   }
   return result;
 }
 
+// Like doColorRamp, but returns packed colors in nativeRaster order; x is
+// treated as a matrix with nrow rows. naColor is red, green, blue and alpha.
 // [[Rcpp::export]]
-StringVector doColorRamp(NumericMatrix colors, NumericVector x, bool alpha, std::string naColor) {
-  for (int col = 0; col < colors.cols(); col++) {
-    double red = colors(0, col) / 255;
-    double green = colors(1, col) / 255;
-    double blue = colors(2, col) / 255;
-    double l, a, b;
-    srgb2lab(red, green, blue, &l, &a, &b);
-    colors(0, col) = l;
-    colors(1, col) = a;
-    colors(2, col) = b;
+IntegerVector doColorRampNative(SEXP ramp, NumericVector x, IntegerVector naColor, int nrow) {
+  if (x.size() == 0) {
+    return IntegerVector(0);
+  }
+  if (naColor.size() != 4) {
+    stop("naColor must have four elements (red, green, blue and alpha)");
+  }
+  if (nrow <= 0 || x.size() % nrow != 0) {
+    stop("x must have a whole number of rows");
+  }
+  unsigned char na[4];
+  for (int i = 0; i < 4; i++) {
+    na[i] = static_cast<unsigned char>(naColor[i]);
   }
-  return doColorRampParallel(colors, x, alpha, naColor);
+
+  IntegerVector result(x.size());
+  PackedColorRampWorker worker(&getColorRamp(ramp), RVector<double>(x),
+    packRGBA(na), nrow, reinterpret_cast<uint32_t*>(result.begin()));
+  parallelFor(0, nrow, worker);
+  return result;
 }
 
-// For unit testing
+// For unit testing. rgb holds the red, green and blue (0-1) of one or more
+// colors, one color after another; so does the result, with L, a and b.
 // [[Rcpp::export]]
 NumericVector rgbToLab(NumericVector rgb) {
-  double l, a, b;
-  srgb2lab(rgb[0], rgb[1], rgb[2], &l, &a, &b);
-  NumericVector result(3);
-  result[0] = l;
-  result[1] = a;
-  result[2] = b;
+  if (rgb.size() % 3 != 0) {
+    stop("rgb must have three values per color");
+  }
+  size_t n = rgb.size() / 3;
+  NumericVector result(rgb.size());
+  if (n == 0) {
+    return result;
+  }
+
+  // The batch conversion works on planar arrays
+  std::vector<double> planes(n * 3);
+  for (size_t i = 0; i < n; i++) {
+    for (size_t c = 0; c < 3; c++) {
+      planes[c * n + i] = rgb[i * 3 + c];
+    }
+  }
+  srgb2lab_n(&planes[0], &planes[n], &planes[n * 2],
+    &planes[0], &planes[n], &planes[n * 2], n);
+  for (size_t i = 0; i < n; i++) {
+    for (size_t c = 0; c < 3; c++) {
+      result[i * 3 + c] = planes[c * n + i];
+    }
+  }
   return result;
 }
 
@@ -0,0 +1,302 @@
+#ifndef COLORS_HPP
+#define COLORS_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <Rcpp.h>
+#include <RcppParallel.h>
+
+#include "nodata.hpp"
+
+// === BEGIN SRGB/LAB CONVERSION =======================================
+
+// Where the piecewise curves of sRGB and CIELAB switch from linear to power
+const double srgb_linear_limit = 0.0031308;
+const double srgb_encoded_limit = 0.04045;
+const double lab_delta = 6.0 / 29.0;
+const double lab_delta_cubed = lab_delta * lab_delta * lab_delta;
+// Slope and offset of the linear part of labf
+const double lab_slope = 1.0 / (3.0 * lab_delta * lab_delta);
+const double lab_slope_inv = 3.0 * lab_delta * lab_delta;
+const double lab_offset = 4.0 / 29.0;
+
+inline double linear2srgb(double c) {
+  double a = 0.055;
+  if (c <= srgb_linear_limit) {
+    return 12.92 * c;
+  } else {
+    return (1 + a) * ::pow(c, 1.0/2.4) - a;
+  }
+}
+
+inline double srgb2linear(double c) {
+  double a = 0.055;
+  if (c <= srgb_encoded_limit) {
+    return c / 12.92;
+  } else {
+    return ::pow((c + a) / (1 + a), 2.4);
+  }
+}
+
+const double d65_x = 0.95320571254937703;
+const double d65_y = 1.0;
+const double d65_z = 1.08538438164691575;
+
+const double srgb_xyz[][3] = {
+  {0.416821341885317054, 0.35657671707797467, 0.179807653586085414},
+  {0.214923504409616606, 0.71315343415594934, 0.071923061434434166},
+  {0.019538500400874251, 0.11885890569265833, 0.946986975553383292}
+};
+
+inline void srgb2xyz(double r, double g, double b, double* x, double *y, double* z) {
+  r = srgb2linear(r);
+  g = srgb2linear(g);
+  b = srgb2linear(b);
+  *x = srgb_xyz[0][0] * r + srgb_xyz[0][1] * g + srgb_xyz[0][2] * b;
+  *y = srgb_xyz[1][0] * r + srgb_xyz[1][1] * g + srgb_xyz[1][2] * b;
+  *z = srgb_xyz[2][0] * r + srgb_xyz[2][1] * g + srgb_xyz[2][2] * b;
+}
+
+const double xyz_srgb[][3] = {
+  { 3.206520517144463067, -1.52104178377365540, -0.493310848791455814},
+  {-0.971982546201231923,  1.88126865160848711,  0.041672484599589298},
+  { 0.055838338593097898, -0.20474057484135894,  1.060928433268858884}
+};
+
+inline void xyz2srgb(double x, double y, double z, double *r, double *g, double *b) {
+  *r = xyz_srgb[0][0] * x + xyz_srgb[0][1] * y + xyz_srgb[0][2] * z;
+  *g = xyz_srgb[1][0] * x + xyz_srgb[1][1] * y + xyz_srgb[1][2] * z;
+  *b = xyz_srgb[2][0] * x + xyz_srgb[2][1] * y + xyz_srgb[2][2] * z;
+  *r = linear2srgb(*r);
+  *g = linear2srgb(*g);
+  *b = linear2srgb(*b);
+}
+
+inline double labf(double t) {
+  if (t > lab_delta_cubed) {
+    return ::cbrt(t);
+  } else {
+    return lab_slope * t + lab_offset;
+  }
+}
+
+inline void xyz2lab(double x, double y, double z, double *l, double *a, double *b) {
+  x = x / d65_x;
+  y = y / d65_y;
+  z = z / d65_z;
+  *l = 116.0 * labf(y) - 16.0;
+  *a = 500.0 * (labf(x) - labf(y));
+  *b = 200.0 * (labf(y) - labf(z));
+}
+
+inline double labf_inv(double t) {
+  if (t > lab_delta) {
+    return t * t * t;
+  } else {
+    return lab_slope_inv * (t - lab_offset);
+  }
+}
+
+inline void lab2xyz(double l, double a, double b, double *x, double *y, double *z) {
+  *y = d65_y * labf_inv(1.0 / 116.0 * (l + 16.0));
+  *x = d65_x * labf_inv(1.0 / 116.0 * (l + 16.0) + 1.0 / 500.0 * a);
+  *z = d65_z * labf_inv(1.0 / 116.0 * (l + 16.0) - 1.0 / 200.0 * b);
+}
+
+inline void srgb2lab(double red, double green, double blue, double *l, double *a, double *b) {
+  double x, y, z;
+  srgb2xyz(red, green, blue, &x, &y, &z);
+  xyz2lab(x, y, z, l, a, b);
+}
+inline void lab2srgb(double l, double a, double b, double *red, double *green, double *blue) {
+  double x, y, z;
+  lab2xyz(l, a, b, &x, &y, &z);
+  xyz2srgb(x, y, z, red, green, blue);
+}
+
+// === END SRGB/LAB CONVERSION =======================================
+
+// Batch versions of srgb2lab and lab2srgb
+#include "color_kernels.hpp"
+
+
+// Packs red, green, blue and alpha (0-255) into one integer, the way R's
+// nativeRaster does.
+inline uint32_t packRGBA(const unsigned char* rgba) {
+  return static_cast<uint32_t>(rgba[0]) |
+    (static_cast<uint32_t>(rgba[1]) << 8) |
+    (static_cast<uint32_t>(rgba[2]) << 16) |
+    (static_cast<uint32_t>(rgba[3]) << 24);
+}
+
+inline void unpackRGBA(uint32_t color, unsigned char* rgba) {
+  rgba[0] = static_cast<unsigned char>(color);
+  rgba[1] = static_cast<unsigned char>(color >> 8);
+  rgba[2] = static_cast<unsigned char>(color >> 16);
+  rgba[3] = static_cast<unsigned char>(color >> 24);
+}
+
+// A color ramp: maps [0,1] to colors interpolated (in CIELAB space) between
+// evenly spaced stops.
+class ColorRamp {
+  // L, a, b and alpha of each stop
+  std::vector<double> _stops;
+  size_t _ncolors;
+  bool _alpha;
+  // Packed colors at evenly spaced points of [0,1], if there is a table
+  std::vector<uint32_t> _table;
+  double _tableScale;
+
+  // Values are converted to colors this many at a time
+  static const size_t CHUNK = 64;
+
+  // Converts n values (all in [0,1]) to packed colors by interpolating
+  // between the stops.
+  void compute(const double* x, size_t n, uint32_t* out) const {
+    double l[CHUNK], a[CHUNK], b[CHUNK], opacity[CHUNK];
+    for (size_t i = 0; i < n; i++) {
+      // Scale the [0,1] value to [0,n-1]
+      double pos = x[i] * (_ncolors - 1);
+      // Find the closest color that's *lower* than x. This'll be one of the
+      // colors we use to interpolate; the other will be colorOffset+1.
+      size_t colorOffset = static_cast<size_t>(::floor(pos));
+      const double* lo = &_stops[colorOffset * 4];
+      if (colorOffset == _ncolors - 1) {
+        // x is exactly at the top of the range. Just use the top color.
+        l[i] = lo[0];
+        a[i] = lo[1];
+        b[i] = lo[2];
+        opacity[i] = lo[3];
+      } else {
+        // Do a linear interp between the two closest colors.
+        const double* hi = lo + 4;
+        double factorB = pos - colorOffset;
+        double factorA = 1 - factorB;
+        l[i] = factorA * lo[0] + factorB * hi[0];
+        a[i] = factorA * lo[1] + factorB * hi[1];
+        b[i] = factorA * lo[2] + factorB * hi[2];
+        opacity[i] = ::round(factorA * lo[3] + factorB * hi[3]);
+      }
+    }
+
+    lab2srgb_n(l, a, b, l, a, b, n);
+    for (size_t i = 0; i < n; i++) {
+      unsigned char rgba[4];
+      rgba[0] = static_cast<unsigned char>(std::max(0.0, std::min(255.0, ::round(l[i] * 255))));
+      rgba[1] = static_cast<unsigned char>(std::max(0.0, std::min(255.0, ::round(a[i] * 255))));
+      rgba[2] = static_cast<unsigned char>(std::max(0.0, std::min(255.0, ::round(b[i] * 255))));
+      rgba[3] = static_cast<unsigned char>(opacity[i]);
+      out[i] = packRGBA(rgba);
+    }
+  }
+
+public:
+  // rgb holds 3 (or 4, if alpha) values between 0 and 255 for each of the
+  // ncolors stops, like the columns of a col2rgb() matrix. If tableSize is at
+  // least 2, that many colors are precomputed, and packed() returns the
+  // nearest of them rather than computing each color exactly.
+  ColorRamp(const double* rgb, size_t ncolors, bool alpha, size_t tableSize = 0) :
+    _stops(ncolors * 4), _ncolors(ncolors), _alpha(alpha), _tableScale(0) {
+
+    size_t channels = alpha ? 4 : 3;
+    for (size_t i = 0; i < ncolors; i++) {
+      const double* color = rgb + i * channels;
+      srgb2lab(color[0] / 255, color[1] / 255, color[2] / 255,
+        &_stops[i*4], &_stops[i*4 + 1], &_stops[i*4 + 2]);
+      _stops[i*4 + 3] = alpha ? color[3] : 255;
+    }
+
+    if (tableSize >= 2) {
+      std::vector<double> x(tableSize);
+      for (size_t i = 0; i < tableSize; i++) {
+        x[i] = static_cast<double>(i) / (tableSize - 1);
+      }
+      std::vector<uint32_t> table(tableSize);
+      packed(&x[0], 1, tableSize, 0, &table[0]);
+      _table.swap(table);
+      _tableScale = static_cast<double>(tableSize - 1);
+    }
+  }
+
+  bool alpha() const {
+    return _alpha;
+  }
+
+  // Writes the colors of the n values x[0], x[stride], x[2*stride]... to
+  // out, packed as by packRGBA. NA/NaN values and values outside of [0,1]
+  // have no color: they get naColor and, if isNA is given, are flagged in it.
+  // Uses the table if there is one.
+  void packed(const double* x, size_t stride, size_t n, uint32_t naColor,
+    uint32_t* out, char* isNA = NULL) const {
+
+    for (size_t begin = 0; begin < n; begin += CHUNK) {
+      size_t end = std::min(n, begin + CHUNK);
+      // The values that have colors, and where they go
+      double valid[CHUNK];
+      size_t index[CHUNK];
+      size_t count = 0;
+      for (size_t i = begin; i < end; i++) {
+        double value = x[i * stride];
+        bool ok = value >= 0 && value <= 1;
+        if (isNA) {
+          isNA[i] = !ok;
+        }
+        if (!ok) {
+          out[i] = naColor;
+        } else if (!_table.empty()) {
+          out[i] = _table[static_cast<size_t>(value * _tableScale + 0.5)];
+        } else {
+          valid[count] = value;
+          index[count++] = i;
+        }
+      }
+
+      if (count > 0) {
+        uint32_t colors[CHUNK];
+        compute(valid, count, colors);
+        for (size_t k = 0; k < count; k++) {
+          out[index[k]] = colors[k];
+        }
+      }
+    }
+  }
+};
+
+// Colors raster values for display: values from lo to hi are mapped onto the
+// color ramp, and everything else (including missing values; see NoData)
+// gets naColor. Colors are packed as by packRGBA.
+template <class T>
+class ColorizeWorker : public RcppParallel::Worker {
+  const T* values;
+  NoData<T> nodata;
+  const ColorRamp* pRamp;
+  double lo, hi;
+  uint32_t naColor;
+  uint32_t* out;
+
+public:
+  ColorizeWorker(const T* values, const NoData<T>& nodata, const ColorRamp* pRamp,
+    double lo, double hi, uint32_t naColor, uint32_t* out) :
+    values(values), nodata(nodata), pRamp(pRamp), lo(lo), hi(hi),
+    naColor(naColor), out(out) {
+  }
+
+  void operator()(std::size_t begin, std::size_t end) {
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    double x[256];
+    for (size_t i = begin; i < end; i += 256) {
+      size_t n = std::min(end - i, static_cast<size_t>(256));
+      for (size_t k = 0; k < n; k++) {
+        T value = values[i + k];
+        x[k] = nodata.missing(value) ? nan :
+          (static_cast<double>(value) - lo) / (hi - lo);
+      }
+      pRamp->packed(x, 1, n, naColor, out + i);
+    }
+  }
+};
+
+#endif
@@ -2,36 +2,239 @@
 #define GRID_HPP
 
 #include <algorithm>
+#include <cstddef>
+#include <string>
 #include <Rcpp.h>
 
+#include "nodata.hpp"
+
 // The type of the integer used for row/col numbers.
 typedef size_t index_t;
 
-// Grid is used to model a 2D matrix or strided array.
-template<class T>
+// How the bands of a multi-band file are laid out, as given by the .grd
+// header's bandorder: band interleaved by line (each row holds a run of
+// cells per band), by pixel (each cell holds a value per band), or band
+// sequential (each band is a whole grid, one after another).
+enum BandOrder {
+  BAND_BIL,
+  BAND_BIP,
+  BAND_BSQ
+};
+
+// Parses a .grd bandorder; returns false if the name is unknown.
+inline bool parseBandOrder(const std::string& name, BandOrder* order) {
+  if (name == "BIL") *order = BAND_BIL;
+  else if (name == "BIP") *order = BAND_BIP;
+  else if (name == "BSQ") *order = BAND_BSQ;
+  else return false;
+  return true;
+}
+
+// The distances between consecutive rows, columns and bands of rows rows of
+// cells in the given band order, whose rows are stride cells apart.
+inline void band_steps(index_t stride, index_t rows, index_t bands,
+  BandOrder order, index_t* rowStep, index_t* colStep, index_t* bandStep) {
+
+  *rowStep = stride;
+  *colStep = 1;
+  *bandStep = stride * rows;
+  // The steps above are BSQ's
+  if (order == BAND_BIL) {
+    *rowStep = stride * bands;
+    *bandStep = stride;
+  } else if (order == BAND_BIP) {
+    *rowStep = stride * bands;
+    *colStep = bands;
+    *bandStep = 1;
+  }
+}
+
+// Layouts are policy classes that place the cells of a Grid in memory; grids
+// are instantiated for a specific layout so that at() can be inlined into the
+// per-pixel loops. Every layout provides
+//
+//   static index_t cells(index_t stride, index_t rows, index_t bands);
+//   static index_t windowStart(index_t row);
+//   static index_t windowEnd(index_t row, index_t nrow);
+//   void init(index_t stride, index_t rows, index_t bands, BandOrder order);
+//   index_t offset(index_t row, index_t col) const;
+//   index_t colStep() const;
+//   index_t bandStep() const;
+//
+// cells() is the number of cells that hold rows rows of a grid (so the first
+// row of a window is that many cells of rows into its file), and a window
+// must start and end on the rows that windowStart() and windowEnd() round
+// to. offset() is the distance of a cell from the first cell of the window,
+// and a cell's other bands follow bandStep() apart.
+
+// The layout of .gri files: one row after another, stride cells apart.
+class RowMajor {
+  index_t _rowStep, _colStep, _bandStep;
+
+public:
+  static index_t cells(index_t stride, index_t rows, index_t bands) {
+    return stride * rows * bands;
+  }
+
+  static index_t windowStart(index_t row) {
+    return row;
+  }
+
+  static index_t windowEnd(index_t row, index_t nrow) {
+    return row;
+  }
+
+  void init(index_t stride, index_t rows, index_t bands, BandOrder order) {
+    band_steps(stride, rows, bands, order, &_rowStep, &_colStep, &_bandStep);
+  }
+
+  index_t offset(index_t row, index_t col) const {
+    return row * _rowStep + col * _colStep;
+  }
+
+  index_t colStep() const {
+    return _colStep;
+  }
+
+  index_t bandStep() const {
+    return _bandStep;
+  }
+};
+
+// The edge length, in cells, of the square tiles of the Tiled layout. A tile
+// of 256x256 cells of 4-byte data is 256KB, so the source cells around a
+// projected tile's path usually sit in a handful of tiles that stay in L2.
+const index_t TILE_SHIFT = 8;
+const index_t TILE_SIZE = static_cast<index_t>(1) << TILE_SHIFT;
+
+// The first row or column of the tile that holds row or column i
+inline index_t tile_start(index_t i) {
+  return i & ~(TILE_SIZE - 1);
+}
+
+// The layout of the tiled copies written by retile_file: the grid is cut into
+// TILE_SIZE-by-TILE_SIZE tiles, stored one after another in row-major order,
+// each holding its cells of every band in the grid's band order. The last row
+// and column of tiles are padded out to full tiles. Projection reads source
+// cells along curved paths, which in a row-major file touch a different row,
+// and often a different page, for nearly every cell; tiles keep the cells
+// around such a path close together.
+class Tiled {
+  // Distances between consecutive rows, columns and bands within a tile
+  index_t _rowStep, _colStep, _bandStep;
+  // Distances between consecutive tiles, and rows of tiles
+  index_t _tileStep, _tileRowStep;
+
+  static index_t roundUp(index_t n) {
+    return (n + TILE_SIZE - 1) & ~(TILE_SIZE - 1);
+  }
+
+public:
+  static index_t cells(index_t stride, index_t rows, index_t bands) {
+    return roundUp(stride) * roundUp(rows) * bands;
+  }
+
+  static index_t windowStart(index_t row) {
+    return tile_start(row);
+  }
+
+  static index_t windowEnd(index_t row, index_t nrow) {
+    return std::min(roundUp(row), nrow);
+  }
+
+  void init(index_t stride, index_t rows, index_t bands, BandOrder order) {
+    band_steps(TILE_SIZE, TILE_SIZE, bands, order,
+      &_rowStep, &_colStep, &_bandStep);
+    _tileStep = TILE_SIZE * TILE_SIZE * bands;
+    _tileRowStep = roundUp(stride) / TILE_SIZE * _tileStep;
+  }
+
+  index_t offset(index_t row, index_t col) const {
+    return (row >> TILE_SHIFT) * _tileRowStep + (col >> TILE_SHIFT) * _tileStep +
+      (row & (TILE_SIZE - 1)) * _rowStep + (col & (TILE_SIZE - 1)) * _colStep;
+  }
+
+  index_t colStep() const {
+    return _colStep;
+  }
+
+  index_t bandStep() const {
+    return _bandStep;
+  }
+};
+
+// Grid is used to model a 2D matrix or strided array, optionally with
+// several bands laid out in any BandOrder. stride is the distance between
+// the rows of one band, not counting the other bands' cells. The cells are
+// placed in memory by TLayout, which is row-major unless the grid is a tiled
+// copy of a file (see Tiled).
+//
+// A Grid can also be a window onto some rows of a larger grid, when only
+// those rows are in memory; its row numbers are still the whole grid's, and
+// only rows within the window may be accessed. A window of no rows just
+// describes the shape of a grid.
+//
+// A grid also knows which of its cells are missing (see NoData); by default
+// only NaN cells are.
+template<class T, class TLayout = RowMajor>
 class Grid {
   T* _begin;
-  const index_t _stride;
   const index_t _nrow;
   const index_t _ncol;
+  const index_t _nband;
+  // The window's first row
+  const index_t _firstRow;
+  TLayout _layout;
+  NoData<T> _nodata;
 
-public:
-  Grid(T* begin, T* end, index_t stride, index_t rows, index_t cols) :
-    _begin(begin), _stride(stride), _nrow(rows), _ncol(cols) {
-
-    if (end - begin != (rows * stride)) {
-      Rcpp::warning("%d != %d", end-begin, rows*cols);
+  void init(T* begin, T* end, index_t stride, index_t windowRows, BandOrder order) {
+    index_t cells = TLayout::cells(stride, windowRows, _nband);
+    if (end - begin != static_cast<ptrdiff_t>(cells)) {
+      Rcpp::warning("%d != %d", end-begin, cells);
     }
 
-    if (rows == 0 || cols == 0) {
+    if (_nrow == 0 || _ncol == 0 || _nband == 0) {
       Rcpp::stop("Grid can't be created with 0 cells");
     }
+    if (TLayout::windowStart(_firstRow) != _firstRow) {
+      Rcpp::stop("Grid window doesn't start on a row of tiles");
+    }
+
+    _layout.init(stride, windowRows, _nband, order);
+  }
+
+  Grid(const Grid& other, T* begin, index_t firstRow) :
+    _begin(begin), _nrow(other._nrow), _ncol(other._ncol), _nband(other._nband),
+    _firstRow(firstRow), _layout(other._layout), _nodata(other._nodata) {
   }
 
-  T* at(index_t row, index_t col) const {
+public:
+  Grid(T* begin, T* end, index_t stride, index_t rows, index_t cols,
+    index_t bands = 1, BandOrder order = BAND_BIL) :
+    _begin(begin), _nrow(rows), _ncol(cols), _nband(bands), _firstRow(0) {
+    init(begin, end, stride, rows, order);
+  }
+
+  // A window of rows [firstRow, firstRow + windowRows) of a rows-by-cols
+  // grid; begin to end holds just those rows.
+  Grid(T* begin, T* end, index_t stride, index_t rows, index_t cols,
+    index_t bands, BandOrder order, index_t firstRow, index_t windowRows) :
+    _begin(begin), _nrow(rows), _ncol(cols), _nband(bands), _firstRow(firstRow) {
+    init(begin, end, stride, windowRows, order);
+  }
+
+  // A window of the same grid, from firstRow, whose cells are at begin and
+  // are laid out as this grid's are. Unlike the constructors it checks
+  // nothing, so it can be used on worker threads, where R can't be called;
+  // firstRow must be a row that TLayout::windowStart() leaves as it is.
+  Grid window(T* begin, index_t firstRow) const {
+    return Grid(*this, begin, firstRow);
+  }
+
+  T* at(index_t row, index_t col, index_t band = 0) const {
     row = std::min(std::max<index_t>(row, 0), _nrow-1);
     col = std::min(std::max<index_t>(col, 0), _ncol-1);
-    return _begin + (row * _stride) + col;
+    return _begin + _layout.offset(row - _firstRow, col) + band * _layout.bandStep();
   }
 
   const index_t nrow() const {
@@ -41,6 +244,72 @@ public:
   const index_t ncol() const {
     return _ncol;
   }
+
+  const index_t nband() const {
+    return _nband;
+  }
+
+  // The distance between consecutive cells of a row; with the Tiled layout,
+  // only within a tile
+  const index_t colStep() const {
+    return _layout.colStep();
+  }
+
+  // The distance between a cell's values in consecutive bands
+  const index_t bandStep() const {
+    return _layout.bandStep();
+  }
+
+  const NoData<T>& nodata() const {
+    return _nodata;
+  }
+
+  void setNodata(const NoData<T>& nodata) {
+    _nodata = nodata;
+  }
+};
+
+// The default edge length (in target cells) of the blocks used by
+// GridBlocks. 64x64 cells of 8-byte data is 32KB, which fits comfortably in
+// L1/L2 alongside the source cells that feed it.
+const index_t DEFAULT_BLOCK_SIZE = 64;
+
+// GridBlocks partitions an nrow-by-ncol grid into rectangular blocks of at
+// most blockSize-by-blockSize cells, numbered in row-major order. Workers
+// should parallelize over block numbers and walk each block row by row, so
+// that consecutive iterations touch neighboring cells of the row-major .gri
+// files instead of striding down a column.
+class GridBlocks {
+  index_t _nrow, _ncol;
+  index_t _blockSize;
+  index_t _blocksAcross, _blocksDown;
+
+public:
+  GridBlocks(index_t nrow, index_t ncol, index_t blockSize = DEFAULT_BLOCK_SIZE) :
+    _nrow(nrow), _ncol(ncol), _blockSize(std::max<index_t>(blockSize, 1)) {
+    _blocksAcross = (_ncol + _blockSize - 1) / _blockSize;
+    _blocksDown = (_nrow + _blockSize - 1) / _blockSize;
+  }
+
+  // Total number of blocks
+  size_t size() const {
+    return _blocksAcross * _blocksDown;
+  }
+
+  // Number of blocks in each row of blocks
+  size_t across() const {
+    return _blocksAcross;
+  }
+
+  // Retrieve the half-open row and column ranges covered by block i.
+  void bounds(size_t i, index_t* row0, index_t* row1,
+    index_t* col0, index_t* col1) const {
+
+    *row0 = (i / _blocksAcross) * _blockSize;
+    *col0 = (i % _blocksAcross) * _blockSize;
+    *row1 = std::min(*row0 + _blockSize, _nrow);
+    *col1 = std::min(*col0 + _blockSize, _ncol);
+  }
 };
 
 #endif
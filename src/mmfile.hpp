@@ -4,6 +4,23 @@
 #include <boost/interprocess/file_mapping.hpp>
 #include <boost/interprocess/mapped_region.hpp>
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#endif
+
+// How a mapped file is going to be read. These are only hints to the
+// kernel, for choosing how far to read ahead of page faults; they're
+// ignored where the OS doesn't support them.
+enum MMAccess {
+  MM_ACCESS_NORMAL,
+  // Every page, front to back: read far ahead
+  MM_ACCESS_SEQUENTIAL,
+  // Scattered pages: don't read ahead at all, so that a fault only reads the
+  // page it needs. Slow when nearby pages are read after all, as every page
+  // then costs a separate read; use willNeed() for parts that are needed.
+  MM_ACCESS_RANDOM
+};
+
 template<class T>
 class MMFile {
   boost::interprocess::file_mapping fm_;
@@ -12,20 +29,57 @@ class MMFile {
   T* begin_;
   T* end_;
 
-public:
-
-  MMFile(const std::string& path, boost::interprocess::mode_t mode) {
+  void map(const std::string& path, boost::interprocess::mode_t mode,
+    boost::interprocess::offset_t offset, size_t size,
+    MMAccess access, bool hugePages) {
     try {
       fm_ = boost::interprocess::file_mapping(path.c_str(), mode);
-      mr_ = boost::interprocess::mapped_region(fm_, mode);
+      mr_ = boost::interprocess::mapped_region(fm_, mode, offset, size);
     } catch(boost::interprocess::interprocess_exception& e) {
       Rcpp::stop("Cannot read file %s", path) ;
     }
 
+    if (access == MM_ACCESS_SEQUENTIAL) {
+      mr_.advise(boost::interprocess::mapped_region::advice_sequential);
+    } else if (access == MM_ACCESS_RANDOM) {
+      mr_.advise(boost::interprocess::mapped_region::advice_random);
+    }
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    if (hugePages && mr_.get_size() > 0) {
+      madvise(mr_.get_address(), mr_.get_size(), MADV_HUGEPAGE);
+    }
+#endif
+  }
+
+public:
+
+  // hugePages asks for the mapping to be backed by transparent huge pages
+  // where possible (on Linux, if they're enabled for madvise). Each page
+  // fault then reads in and maps a much larger run of the file, which cuts
+  // both page faults and TLB misses on large sources.
+  MMFile(const std::string& path, boost::interprocess::mode_t mode,
+    MMAccess access = MM_ACCESS_NORMAL, bool hugePages = false) {
+    map(path, mode, 0, 0, access, hugePages);
     begin_ = static_cast<T*>(mr_.get_address());
     end_ = begin_ + mr_.get_size() / sizeof(T);
   }
 
+  // Maps just the size bytes of the file starting at offset (e.g. the rows
+  // of a raster that are going to be read), which begin() to end() then
+  // cover. size must be positive.
+  MMFile(const std::string& path, boost::interprocess::mode_t mode,
+    boost::interprocess::offset_t offset, size_t size,
+    MMAccess access = MM_ACCESS_NORMAL, bool hugePages = false) {
+    // The mapping itself has to start on a page boundary
+    boost::interprocess::offset_t pageSize =
+      boost::interprocess::mapped_region::get_page_size();
+    boost::interprocess::offset_t start = offset / pageSize * pageSize;
+    map(path, mode, start, size + (offset - start), access, hugePages);
+    begin_ = reinterpret_cast<T*>(
+      static_cast<char*>(mr_.get_address()) + (offset - start));
+    end_ = begin_ + size / sizeof(T);
+  }
+
   T* begin() {
     return begin_;
   }
@@ -38,6 +92,23 @@ public:
     mr_.flush();
   }
 
+  // Asks for the pages holding [begin, end) to be read in the background,
+  // so that they're in memory by the time they're touched.
+  void willNeed(const T* begin, const T* end) {
+#if defined(__unix__) || defined(__APPLE__)
+    if (begin >= end) {
+      return;
+    }
+    // madvise wants a page-aligned start
+    size_t pageSize = boost::interprocess::mapped_region::get_page_size();
+    const char* p = reinterpret_cast<const char*>(begin);
+    const char* pageStart = static_cast<const char*>(mr_.get_address()) +
+      (p - static_cast<const char*>(mr_.get_address())) / pageSize * pageSize;
+    posix_madvise(const_cast<char*>(pageStart),
+      reinterpret_cast<const char*>(end) - pageStart, POSIX_MADV_WILLNEED);
+#endif
+  }
+
 };
 
 #endif
@@ -0,0 +1,92 @@
+#ifndef NODATA_HPP
+#define NODATA_HPP
+
+#include <cmath>
+#include <limits>
+
+// The missing cells of a grid of T. raster marks a missing cell by writing
+// the .grd header's nodatavalue into it, and floating-point cells can also
+// be NaN (which raster reads as NA too). A grid without a nodata value of
+// its own, or whose nodata value T can't hold, only has NaN cells missing.
+//
+// na() is what a worker writes into a missing target cell: the nodata
+// value, so that raster reads the cell back as NA, or NaN without one.
+// Integer types have no NaN, so a grid of them without a nodata value falls
+// back to the type's most negative value (or, if unsigned, its largest),
+// which is what raster uses for most integer types.
+template <class T>
+class NoData {
+  bool _has;
+  T _value;
+
+public:
+  NoData() : _has(false), _value() {
+  }
+
+  explicit NoData(double nodata) : _has(representable(nodata)),
+    _value(_has ? static_cast<T>(nodata) : T()) {
+  }
+
+  // Whether T can hold nodata. Floating-point values only need to be in
+  // range, as they're rounded to T when they're written.
+  static bool representable(double nodata) {
+    if (!std::numeric_limits<T>::is_integer) {
+      return std::abs(nodata) <= std::numeric_limits<T>::max();
+    }
+    return nodata >= static_cast<double>(std::numeric_limits<T>::min()) &&
+      nodata <= static_cast<double>(std::numeric_limits<T>::max()) &&
+      static_cast<double>(static_cast<T>(nodata)) == nodata;
+  }
+
+  bool has() const {
+    return _has;
+  }
+
+  bool missing(T value) const {
+    return value != value || (_has && value == _value);
+  }
+
+  // Whether any cell can be missing at all
+  bool possible() const {
+    return _has || std::numeric_limits<T>::has_quiet_NaN;
+  }
+
+  // Whether any of the n cells at cells are missing. The comparisons are
+  // combined without branching, so that the loop vectorizes.
+  bool any(const T* cells, size_t n) const {
+    const T value = _value;
+    const bool has = _has;
+    bool found = false;
+    for (size_t i = 0; i < n; i++) {
+      found |= (cells[i] != cells[i]) | (has & (cells[i] == value));
+    }
+    return found;
+  }
+
+  T na() const {
+    if (_has)
+      return _value;
+    if (std::numeric_limits<T>::has_quiet_NaN)
+      return std::numeric_limits<T>::quiet_NaN();
+    return std::numeric_limits<T>::is_signed ?
+      std::numeric_limits<T>::min() : std::numeric_limits<T>::max();
+  }
+
+  // The nodata value as the double that the vectorized kernels compare
+  // widened cells with; NaN, which is unequal to every cell, if there's
+  // none.
+  double compareValue() const {
+    return _has ? static_cast<double>(_value) :
+      std::numeric_limits<double>::quiet_NaN();
+  }
+};
+
+// NoData<bool>: bool can't be NaN, and its largest value is true, which is
+// no better a marker than false; a LOG1S grid without a representable
+// nodata value writes missing cells as false.
+template <>
+inline bool NoData<bool>::na() const {
+  return _has ? _value : false;
+}
+
+#endif
@@ -0,0 +1,288 @@
+#ifndef OUTPUT_HPP
+#define OUTPUT_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <Rcpp.h>
+#include <RcppParallel.h>
+
+#ifdef _WIN32
+#include <cstdio>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "grid.hpp"
+#include "mmfile.hpp"
+
+// How output files are written. OUTPUT_MMAP maps the (pre-sized) file
+// read/write and lets workers write straight into it. The other backends
+// leave the file unmapped: workers render bands of rows into buffers of
+// their own, and write each band to the file with a positioned write. That
+// avoids a page fault and a zero-fill on the first touch of every output
+// page, and the kernel flushing dirty pages whenever it chooses; which is
+// faster for large outputs and on network filesystems. OUTPUT_WRITE_BEHIND
+// also asks the kernel to start writing each band out right away, so dirty
+// pages don't pile up in the page cache (on Linux; elsewhere it's the same
+// as OUTPUT_WRITE). OUTPUT_MEMORY renders into a buffer instead of a file
+// (see OutputTarget's in-memory constructor), and has no name.
+enum OutputBackend {
+  OUTPUT_MMAP,
+  OUTPUT_WRITE,
+  OUTPUT_WRITE_BEHIND,
+  OUTPUT_MEMORY
+};
+
+// Parses a backend name; returns false if the name is unknown.
+inline bool parseOutputBackend(const std::string& name, OutputBackend* backend) {
+  if (name == "mmap") *backend = OUTPUT_MMAP;
+  else if (name == "write") *backend = OUTPUT_WRITE;
+  else if (name == "write-behind") *backend = OUTPUT_WRITE_BEHIND;
+  else return false;
+  return true;
+}
+
+// An existing file that any number of threads can write to at once, each
+// at its own offset.
+class PositionedFile {
+#ifdef _WIN32
+  // No pwrite; seek and write under a lock instead
+  FILE* file_;
+  tthread::mutex mutex_;
+#else
+  int fd_;
+#endif
+  bool writeBehind_;
+
+  // Not copyable
+  PositionedFile(const PositionedFile&);
+  PositionedFile& operator=(const PositionedFile&);
+
+public:
+  PositionedFile(const std::string& path, bool writeBehind) :
+    writeBehind_(writeBehind) {
+#ifdef _WIN32
+    file_ = fopen(path.c_str(), "r+b");
+    if (file_ == NULL) {
+      Rcpp::stop("Cannot write file %s", path);
+    }
+#else
+    fd_ = open(path.c_str(), O_WRONLY);
+    if (fd_ < 0) {
+      Rcpp::stop("Cannot write file %s", path);
+    }
+#endif
+  }
+
+  ~PositionedFile() {
+#ifdef _WIN32
+    fclose(file_);
+#else
+    close(fd_);
+#endif
+  }
+
+  // Returns false if the data couldn't all be written. Safe to call from
+  // worker threads, as it doesn't call back into R.
+  bool write(const void* data, size_t bytes, uint64_t offset) {
+#ifdef _WIN32
+    tthread::lock_guard<tthread::mutex> lock(mutex_);
+    return _fseeki64(file_, offset, SEEK_SET) == 0 &&
+      fwrite(data, 1, bytes, file_) == bytes;
+#else
+    const char* p = static_cast<const char*>(data);
+    size_t left = bytes;
+    while (left > 0) {
+      ssize_t written = pwrite(fd_, p, left, offset + (bytes - left));
+      if (written < 0 && errno == EINTR)
+        continue;
+      if (written <= 0)
+        return false;
+      p += written;
+      left -= written;
+    }
+#if defined(__linux__) && defined(SYNC_FILE_RANGE_WRITE)
+    // Only starts the writeback; doesn't wait for it
+    if (writeBehind_) {
+      sync_file_range(fd_, offset, bytes, SYNC_FILE_RANGE_WRITE);
+    }
+#endif
+    return true;
+#endif
+  }
+};
+
+// Runs a renderer over the target in bands of rows, for the write backends
+// (see OutputBackend). Each call renders its bands one at a time into a
+// buffer of its own, which is reused from band to band, and writes each one
+// to the file as soon as it's done. The renderer must provide
+//
+//   void render(size_t begin, size_t end, Grid<T>* pOut);
+//
+// which renders work units begin to end (blocks, bands or rows, depending on
+// the renderer) into the window pOut. Band i covers target rows
+// [i * rowsPerBand, (i + 1) * rowsPerBand) and work units
+// [i * unitsPerBand, (i + 1) * unitsPerBand), both cut short at the end of
+// the target.
+template <class T, class TRenderer>
+class StreamingWorker : public RcppParallel::Worker {
+  TRenderer* pRenderer;
+  PositionedFile* pFile;
+  index_t stride, nrow, ncol;
+  index_t rowsPerBand;
+  size_t unitsPerBand, units;
+  // The target's shape, checked here on the main thread; each band's window
+  // is made from it with Grid::window(), which doesn't call into R
+  Grid<T> shape;
+
+public:
+  // Failed writes, which are reported once all threads are done
+  tthread::mutex mutex;
+  bool failed;
+
+  StreamingWorker(TRenderer* pRenderer, PositionedFile* pFile,
+    index_t stride, index_t nrow, index_t ncol,
+    index_t rowsPerBand, size_t unitsPerBand, size_t units) :
+  pRenderer(pRenderer), pFile(pFile), stride(stride), nrow(nrow), ncol(ncol),
+  rowsPerBand(rowsPerBand), unitsPerBand(unitsPerBand), units(units),
+  shape(NULL, NULL, stride, nrow, ncol, 1, BAND_BIL, 0, 0),
+  failed(false) {
+  }
+
+  // The number of bands
+  size_t size() const {
+    return (nrow + rowsPerBand - 1) / rowsPerBand;
+  }
+
+  // begin and end are band numbers
+  void operator()(std::size_t begin, std::size_t end) {
+    // A byte buffer rather than a std::vector<T>, which doesn't work for bool
+    std::vector<char> buffer(rowsPerBand * stride * sizeof(T));
+    T* data = reinterpret_cast<T*>(&buffer[0]);
+
+    for (size_t band = begin; band < end; band++) {
+      index_t row0 = band * rowsPerBand;
+      index_t rows = std::min(rowsPerBand, nrow - row0);
+      Grid<T> window = shape.window(data, row0);
+
+      pRenderer->render(band * unitsPerBand,
+        std::min((band + 1) * unitsPerBand, units), &window);
+
+      if (!pFile->write(data, rows * stride * sizeof(T),
+        static_cast<uint64_t>(row0) * stride * sizeof(T))) {
+        tthread::lock_guard<tthread::mutex> lock(mutex);
+        failed = true;
+        return;
+      }
+    }
+  }
+};
+
+// The target file of a resampling or aggregation, written with the given
+// backend. grid() is what workers should be constructed with: the whole
+// mapped file for OUTPUT_MMAP, the buffer for OUTPUT_MEMORY, and otherwise
+// a window of no rows that gives just the target's shape (the rows are
+// rendered into StreamingWorker's buffers instead).
+template <class T>
+class OutputTarget {
+  std::string path_;
+  OutputBackend backend_;
+  index_t stride_;
+  boost::scoped_ptr<MMFile<T> > file_;
+  Grid<T> grid_;
+
+  // Not copyable
+  OutputTarget(const OutputTarget&);
+  OutputTarget& operator=(const OutputTarget&);
+
+public:
+  OutputTarget(const std::string& path, OutputBackend backend,
+    index_t stride, index_t rows, index_t cols) :
+    path_(path), backend_(backend), stride_(stride),
+    file_(backend == OUTPUT_MMAP ?
+      new MMFile<T>(path, boost::interprocess::read_write) : NULL),
+    grid_(file_ ? file_->begin() : NULL, file_ ? file_->end() : NULL,
+      stride, rows, cols, 1, BAND_BIL, 0, file_ ? rows : 0) {
+  }
+
+  // A target in memory at data, which must have room for rows * stride
+  // cells.
+  OutputTarget(T* data, index_t stride, index_t rows, index_t cols) :
+    backend_(OUTPUT_MEMORY), stride_(stride),
+    grid_(data, data + rows * stride, stride, rows, cols) {
+  }
+
+  Grid<T>* grid() {
+    return &grid_;
+  }
+
+  // Runs pWorker over all of its work units, which are laid out as
+  // StreamingWorker describes. With OUTPUT_MMAP and OUTPUT_MEMORY the units
+  // are handed out to threads one by one, as usual; otherwise they go out in
+  // bands of rows.
+  template <class TWorker>
+  void render(TWorker* pWorker, index_t rowsPerBand, size_t unitsPerBand,
+    size_t units) {
+
+    if (backend_ == OUTPUT_MMAP || backend_ == OUTPUT_MEMORY) {
+      RcppParallel::parallelFor(0, units, *pWorker);
+      return;
+    }
+
+    PositionedFile file(path_, backend_ == OUTPUT_WRITE_BEHIND);
+    StreamingWorker<T, TWorker> streamer(pWorker, &file, stride_,
+      grid_.nrow(), grid_.ncol(), rowsPerBand, unitsPerBand, units);
+    RcppParallel::parallelFor(0, streamer.size(), streamer);
+    if (streamer.failed) {
+      Rcpp::stop("Error writing file %s", path_);
+    }
+  }
+};
+
+// Copies a raster rendered in memory into values, in the order of the
+// values of a Raster object: band by band, and row by row within each band.
+// Missing cells (NaN, or holding the nodata value; see NoData) become NA, as
+// they would when raster reads them from a file.
+template <class T>
+class ValuesWorker : public RcppParallel::Worker {
+  const Grid<T>* pSrc;
+  NoData<T> nodata;
+  double na;
+  double* values;
+
+public:
+  ValuesWorker(const Grid<T>* pSrc, double nodata, double* values) :
+    pSrc(pSrc), nodata(nodata), na(NA_REAL), values(values) {
+  }
+
+  // begin and end are rows
+  void operator()(std::size_t begin, std::size_t end) {
+    index_t nrow = pSrc->nrow(), ncol = pSrc->ncol();
+    for (index_t b = 0; b < pSrc->nband(); b++) {
+      for (index_t y = begin; y < end; y++) {
+        const T* in = pSrc->at(y, 0, b);
+        double* out = values + (b * nrow + y) * ncol;
+        for (index_t x = 0; x < ncol; x++, in += pSrc->colStep()) {
+          T v = *in;
+          out[x] = nodata.missing(v) ? na : static_cast<double>(v);
+        }
+      }
+    }
+  }
+};
+
+template <class T>
+void copy_values(const Grid<T>& src, double nodata, double* values) {
+  ValuesWorker<T> worker(&src, nodata, values);
+  RcppParallel::parallelFor(0, src.nrow(), worker);
+}
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef PNG_HPP
+#define PNG_HPP
+
+#include <string>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+#include <zlib.h>
+#include <Rcpp.h>
+
+#include "colors.hpp"
+
+// Minimal PNG encoder for 8-bit RGBA images, used to return map tiles without
+// going through R's graphics devices.
+
+inline void png_put_uint32(std::vector<unsigned char>* out, uint32_t value) {
+  out->push_back(static_cast<unsigned char>(value >> 24));
+  out->push_back(static_cast<unsigned char>(value >> 16));
+  out->push_back(static_cast<unsigned char>(value >> 8));
+  out->push_back(static_cast<unsigned char>(value));
+}
+
+// Appends a chunk (length, type, data and CRC) to out.
+inline void png_put_chunk(std::vector<unsigned char>* out, const char* type,
+  const unsigned char* data, size_t length) {
+
+  png_put_uint32(out, static_cast<uint32_t>(length));
+  size_t start = out->size();
+  out->insert(out->end(), type, type + 4);
+  out->insert(out->end(), data, data + length);
+  uLong crc = crc32(0L, Z_NULL, 0);
+  crc = crc32(crc, &(*out)[start], static_cast<uInt>(length + 4));
+  png_put_uint32(out, static_cast<uint32_t>(crc));
+}
+
+/**
+ * Encode an image as PNG.
+ *
+ * @param pixels width * height colors, row by row, packed as by packRGBA.
+ * @param level zlib compression level, 0-9.
+ * @param out Receives the encoded file.
+ */
+inline void encode_png(const uint32_t* pixels, size_t width, size_t height,
+  int level, std::vector<unsigned char>* out) {
+
+  // Each row is stored with the "Sub" filter (each byte minus the same
+  // channel of the pixel to its left), which helps deflate a lot on the
+  // smooth gradients of colorized rasters.
+  size_t rowBytes = width * 4;
+  std::vector<unsigned char> filtered(height * (rowBytes + 1));
+  for (size_t y = 0; y < height; y++) {
+    const uint32_t* in = pixels + y * width;
+    unsigned char* row = &filtered[y * (rowBytes + 1)];
+    row[0] = 1;
+    unsigned char left[4] = {0, 0, 0, 0};
+    for (size_t x = 0; x < width; x++) {
+      unsigned char rgba[4];
+      unpackRGBA(in[x], rgba);
+      for (int c = 0; c < 4; c++) {
+        row[1 + x*4 + c] = static_cast<unsigned char>(rgba[c] - left[c]);
+        left[c] = rgba[c];
+      }
+    }
+  }
+
+  uLongf compressedSize = compressBound(static_cast<uLong>(filtered.size()));
+  std::vector<unsigned char> compressed(compressedSize);
+  if (compress2(&compressed[0], &compressedSize, &filtered[0],
+      static_cast<uLong>(filtered.size()), level) != Z_OK) {
+    Rcpp::stop("PNG compression failed");
+  }
+
+  static const unsigned char signature[] = {137, 80, 78, 71, 13, 10, 26, 10};
+  out->clear();
+  out->insert(out->end(), signature, signature + 8);
+
+  std::vector<unsigned char> header;
+  png_put_uint32(&header, static_cast<uint32_t>(width));
+  png_put_uint32(&header, static_cast<uint32_t>(height));
+  header.push_back(8);  // bit depth
+  header.push_back(6);  // color type: RGBA
+  header.push_back(0);  // compression: deflate
+  header.push_back(0);  // filter method: adaptive
+  header.push_back(0);  // no interlacing
+  png_put_chunk(out, "IHDR", &header[0], header.size());
+  png_put_chunk(out, "IDAT", &compressed[0], compressedSize);
+  png_put_chunk(out, "IEND", NULL, 0);
+}
+
+#endif
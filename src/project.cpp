@@ -2,74 +2,737 @@
 // [[Rcpp::depends(RcppParallel)]]
 #include <RcppParallel.h>
 
+#include <cstring>
+#include <iomanip>
+
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <boost/scoped_ptr.hpp>
+
 #include "mmfile.hpp"
 #include "grid.hpp"
+#include "output.hpp"
 #include "resample_algos.hpp"
 #include "project_algos.hpp"
+#include "tile_cache.hpp"
+#include "colors.hpp"
+#include "png.hpp"
+#include "raster_source.hpp"
 
-template <class T>
-void project_files(
-    const std::string& name,
-    const std::string& method,
-    const std::string& from, index_t fromStride, index_t fromRows, index_t fromCols,
-    int lng1, int lng2, int lat1, int lat2,
-    const std::string& to, index_t toStride, index_t toRows, index_t toCols,
-    index_t x, index_t y, index_t totalWidth, index_t totalHeight
-) {
-  boost::shared_ptr<Projection<T> > pProject = getProjection<T>(name);
-  if (!pProject) {
-    Rcpp::stop("Unsupported projection: %s", name);
-  }
-  boost::shared_ptr<Interpolator<T> > pInterp = getInterpolator<T>(method);
-  if (!pInterp) {
-    Rcpp::stop("Unsupported interpolator: %s", method);
-  }
+// The most output files that are mapped at the same time.
+const size_t MAX_MAPPED_TILES = 256;
 
-  // Memory mapped files
-  MMFile<T> from_f(from, boost::interprocess::read_only);
-  MMFile<T> to_f(to, boost::interprocess::read_write);
+// The parameters of a projection that are the same for every tile.
+struct ProjectionRequest {
+  std::string name, method, dataFormat;
+  std::string from;
+  index_t fromStride, fromRows, fromCols;
+  int lng1, lng2, lat1, lat2;
+  index_t toStride, toRows, toCols;
+  index_t totalWidth, totalHeight;
+  index_t blockSize;
+  // The source's bands and their layout, which the targets share
+  index_t bands;
+  BandOrder order;
+  // Whether the source file is a tiled copy (see Tiled and retile_file); the
+  // targets are row-major either way
+  bool tiled;
+  // Whether the source is in the other byte order than the host's; the
+  // interpolators then swap each cell they read, and the targets are in
+  // host order
+  bool swapBytes;
+  // The nodata values of the source and of the targets: source cells with
+  // fromNA are missing, and target cells without any source data get toNA
+  // (see NoData)
+  double fromNA, toNA;
+  // The source, if it's already open (see openRasterSource); otherwise it's
+  // mapped from the file named by from
+  RasterSource* pSource;
+};
 
-  // Grid will help us conveniently offset into mmap by row/col
-  Grid<T> from_g(from_f.begin(), from_f.end(), fromStride, fromRows, fromCols);
-  Grid<T> to_g(to_f.begin(), to_f.end(), toStride, toRows, toCols);
+// A dimension passed from R, as an index_t; it must not be negative.
+inline index_t to_index(int value, const char* name) {
+  if (value < 0) {
+    Rcpp::stop("%s must not be negative", name);
+  }
+  return static_cast<index_t>(value);
+}
 
-  project<T>(pProject.get(), pInterp.get(), from_g, lat1, lat2, lng1, lng2,
-    to_g, x, totalWidth, y, totalHeight);
+// The data type, projection and interpolator are all fixed at compile time.
+// dispatch_format instantiates TAction<T> for the request's data type, and
+// calls it with the request's projection and interpolator.
+template <class T, template <class> class TAction, class TProj>
+void dispatch_interp(const ProjectionRequest& req, const TProj& proj, const TAction<T>& action) {
+  if (req.method == "bilinear") {
+    action(proj, Bilinear<T>(req.swapBytes));
+  } else if (req.method == "ngb") {
+    action(proj, NearestNeighbor<T>(req.swapBytes));
+  } else {
+    Rcpp::stop("Unsupported interpolator: %s", req.method);
+  }
 }
 
-// TODO: Implement dataFormat, method
+template <class T, template <class> class TAction>
+void dispatch_projection(const ProjectionRequest& req, const TAction<T>& action) {
+  if (req.name == "epsg:3857") {
+    dispatch_interp<T>(req, WebMercatorProjection(), action);
+  } else if (req.name == "mollweide") {
+    dispatch_interp<T>(req, MollweideProjection(), action);
+  } else {
+    Rcpp::stop("Unsupported projection: %s", req.name);
+  }
+}
 
-// [[Rcpp::export]]
-void do_project(
-    const std::string& name,
-    const std::string& from, int fromStride, int fromRows, int fromCols,
-    int lng1, int lng2, int lat1, int lat2,
-    const std::string& to, int toStride, int toRows, int toCols,
-    int x, int y, int totalWidth, int totalHeight,
-    const std::string& dataFormat, const std::string& method
-) {
+template <template <class> class TAction, class TArgs>
+void dispatch_format(const ProjectionRequest& req, const TArgs& args) {
+  const std::string& dataFormat = req.dataFormat;
   if (dataFormat == "FLT8S") {
-    project_files<double>(name, method, from, fromStride, fromRows, fromCols, lng1, lng2, lat1, lat2, to, toStride, toRows, toCols, x, y, totalWidth, totalHeight);
+    dispatch_projection<double>(req, TAction<double>(req, args));
   } else if (dataFormat == "FLT4S") {
-    project_files<float>(name, method, from, fromStride, fromRows, fromCols, lng1, lng2, lat1, lat2, to, toStride, toRows, toCols, x, y, totalWidth, totalHeight);
+    dispatch_projection<float>(req, TAction<float>(req, args));
   } else if (dataFormat == "INT4U") {
-    project_files<uint32_t>(name, method, from, fromStride, fromRows, fromCols, lng1, lng2, lat1, lat2, to, toStride, toRows, toCols, x, y, totalWidth, totalHeight);
+    dispatch_projection<uint32_t>(req, TAction<uint32_t>(req, args));
   } else if (dataFormat == "INT4S") {
-    project_files<int32_t>(name, method, from, fromStride, fromRows, fromCols, lng1, lng2, lat1, lat2, to, toStride, toRows, toCols, x, y, totalWidth, totalHeight);
+    dispatch_projection<int32_t>(req, TAction<int32_t>(req, args));
   } else if (dataFormat == "INT2U") {
-    project_files<uint16_t>(name, method, from, fromStride, fromRows, fromCols, lng1, lng2, lat1, lat2, to, toStride, toRows, toCols, x, y, totalWidth, totalHeight);
+    dispatch_projection<uint16_t>(req, TAction<uint16_t>(req, args));
   } else if (dataFormat == "INT2S") {
-    project_files<int16_t>(name, method, from, fromStride, fromRows, fromCols, lng1, lng2, lat1, lat2, to, toStride, toRows, toCols, x, y, totalWidth, totalHeight);
+    dispatch_projection<int16_t>(req, TAction<int16_t>(req, args));
   } else if (dataFormat == "INT1U") {
-    project_files<uint8_t>(name, method, from, fromStride, fromRows, fromCols, lng1, lng2, lat1, lat2, to, toStride, toRows, toCols, x, y, totalWidth, totalHeight);
+    dispatch_projection<uint8_t>(req, TAction<uint8_t>(req, args));
   } else if (dataFormat == "INT1S") {
-    project_files<int8_t>(name, method, from, fromStride, fromRows, fromCols, lng1, lng2, lat1, lat2, to, toStride, toRows, toCols, x, y, totalWidth, totalHeight);
+    dispatch_projection<int8_t>(req, TAction<int8_t>(req, args));
   } else if (dataFormat == "LOG1S") {
     if (sizeof(bool) != 1) {
       Rcpp::stop("The size of 'bool' on your architecture is not 1 byte. Please report this issue to the rasterfaster author.");
     }
-    project_files<bool>(name, method, from, fromStride, fromRows, fromCols, lng1, lng2, lat1, lat2, to, toStride, toRows, toCols, x, y, totalWidth, totalHeight);
+    dispatch_projection<bool>(req, TAction<bool>(req, args));
   } else {
     Rcpp::stop("Unknown data format: %s", dataFormat);
   }
 }
+
+// The source cells that a tile can read; see source_bounds.
+struct SourceBounds {
+  bool overlaps;
+  index_t row0, row1, col0, col1;
+};
+
+template <class TProj>
+SourceBounds tile_source_bounds(const ProjectionRequest& req, const TProj& proj,
+  int x, int y) {
+
+  SourceBounds bounds;
+  bounds.overlaps = source_bounds(proj, req.fromRows, req.fromCols,
+    req.lat1, req.lat2, req.lng1, req.lng2, req.toRows, req.toCols,
+    x, y, req.totalWidth, req.totalHeight,
+    &bounds.row0, &bounds.row1, &bounds.col0, &bounds.col1);
+  return bounds;
+}
+
+// The source, or just the rows of it that some tiles read, mapped into
+// memory. Rendering a tile of a large source only needs a few of its rows,
+// and mapping just those saves address space and mapping setup. Multi-band
+// row-major BSQ sources are always mapped whole, as each band's rows are far
+// apart; and an open source is used as it is, since it's already mapped
+// whole. TLayout is the source file's layout: a tiled source is mapped whole
+// rows of tiles at a time.
+template <class T, class TLayout>
+class SourceWindow {
+  index_t row0_, row1_;
+  boost::scoped_ptr<MMFile<char> > ownFile_;
+  MMFile<char>* file_;
+  Grid<T, TLayout> grid_;
+
+  static bool whole(const ProjectionRequest& req) {
+    return req.pSource ||
+      (req.bands > 1 && req.order == BAND_BSQ && !req.tiled);
+  }
+
+  static index_t firstRow(const ProjectionRequest& req, index_t row0) {
+    return whole(req) ? 0 : TLayout::windowStart(row0);
+  }
+
+  static index_t endRow(const ProjectionRequest& req, index_t row1) {
+    return whole(req) ? req.fromRows : TLayout::windowEnd(row1, req.fromRows);
+  }
+
+  // The number of cells of every band in rows rows
+  static index_t cells(const ProjectionRequest& req, index_t rows) {
+    return TLayout::cells(req.fromStride, rows, req.bands);
+  }
+
+  static boost::interprocess::offset_t bytes(index_t cells) {
+    return static_cast<boost::interprocess::offset_t>(cells) * sizeof(T);
+  }
+
+  void hint(const T* begin, const T* end) {
+    file_->willNeed(reinterpret_cast<const char*>(begin),
+      reinterpret_cast<const char*>(end));
+  }
+
+public:
+  // Maps rows [row0, row1) of the source, which must not be empty; or
+  // just uses the source if it's open.
+  SourceWindow(const ProjectionRequest& req, index_t row0, index_t row1) :
+    row0_(firstRow(req, row0)), row1_(endRow(req, row1)),
+    ownFile_(req.pSource ? NULL : new MMFile<char>(req.from,
+      boost::interprocess::read_only,
+      bytes(cells(req, row0_)), bytes(cells(req, row1_ - row0_)),
+      MM_ACCESS_NORMAL, true)),
+    file_(req.pSource ? &req.pSource->file : ownFile_.get()),
+    grid_(reinterpret_cast<T*>(file_->begin()),
+      reinterpret_cast<T*>(file_->begin()) + cells(req, row1_ - row0_),
+      req.fromStride, req.fromRows,
+      req.fromCols, req.bands, req.order, row0_, row1_ - row0_) {
+    grid_.setNodata(NoData<T>(req.fromNA));
+  }
+
+  const Grid<T, TLayout>& grid() const {
+    return grid_;
+  }
+
+  // Hints that the source cells within bounds will be needed soon, so that
+  // they're read in ahead of the workers. Only done if the tile reads most
+  // of those cells: a tile that's much smaller than its source bounds (a
+  // zoomed-out view) only reads scattered rows and columns of them, and
+  // reading them all would mostly be wasted.
+  void willNeed(const ProjectionRequest& req, const SourceBounds& bounds) {
+    if ((bounds.row1 - bounds.row0) * (bounds.col1 - bounds.col0) >
+      4 * req.toRows * req.toCols) {
+      return;
+    }
+
+    const T* pendingBegin = NULL;
+    const T* pendingEnd = NULL;
+    if (req.tiled) {
+      // The tiles of a row of tiles, every band included, are one run
+      index_t tileCells = TILE_SIZE * TILE_SIZE * grid_.nband();
+      for (index_t row = tile_start(bounds.row0); row < bounds.row1; row += TILE_SIZE) {
+        addRun(grid_.at(row, tile_start(bounds.col0)),
+          grid_.at(row, tile_start(bounds.col1 - 1)) + tileCells,
+          &pendingBegin, &pendingEnd);
+      }
+      hint(pendingBegin, pendingEnd);
+      return;
+    }
+
+    // Interleaved bands (BIP) are read together; otherwise each band's row
+    // is a separate run of cells.
+    bool together = grid_.bandStep() == 1;
+    for (index_t row = bounds.row0; row < bounds.row1; row++) {
+      for (index_t b = 0; b < (together ? 1 : grid_.nband()); b++) {
+        addRun(grid_.at(row, bounds.col0, b),
+          grid_.at(row, bounds.col1 - 1, together ? grid_.nband() - 1 : b) + 1,
+          &pendingBegin, &pendingEnd);
+      }
+    }
+    hint(pendingBegin, pendingEnd);
+  }
+
+private:
+  // Adds the run of cells [begin, end) to the pending run if they touch, so
+  // that they're hinted together; otherwise hints the pending run and starts
+  // a new one.
+  void addRun(const T* begin, const T* end,
+    const T** pendingBegin, const T** pendingEnd) {
+    if (begin != *pendingEnd) {
+      hint(*pendingBegin, *pendingEnd);
+      *pendingBegin = begin;
+    }
+    *pendingEnd = end;
+  }
+
+};
+
+// The outputs of a batch: output i receives the tile whose top-left corner
+// is at x[i], y[i] in the projected world. The outputs are the files named
+// by to or, if data isn't empty, the buffers it points to, each with room
+// for a tile.
+struct TileTargets {
+  std::vector<std::string> to;
+  std::vector<char*> data;
+  std::vector<int> x, y;
+
+  size_t size() const {
+    return x.size();
+  }
+};
+
+// Maps the files, if any, and runs the projection.
+template <class T>
+class ProjectTiles {
+  const ProjectionRequest& req;
+  const TileTargets& targets;
+
+public:
+  ProjectTiles(const ProjectionRequest& req, const TileTargets& targets) :
+    req(req), targets(targets) {
+  }
+
+  template <class TProj, class TInterp>
+  void operator()(const TProj& proj, const TInterp& interp) const {
+    if (req.tiled) {
+      render<Tiled>(proj, interp);
+    } else {
+      render<RowMajor>(proj, interp);
+    }
+  }
+
+private:
+  // Renders from a source of the given layout
+  template <class TLayout, class TProj, class TInterp>
+  void render(const TProj& proj, const TInterp& interp) const {
+    // Only the source rows that some tile reads are mapped, once for the
+    // whole batch; not at all if every tile lies outside the source.
+    std::vector<SourceBounds> bounds(targets.size());
+    index_t row0 = req.fromRows, row1 = 0;
+    for (size_t i = 0; i < targets.size(); i++) {
+      bounds[i] = tile_source_bounds(req, proj, targets.x[i], targets.y[i]);
+      if (bounds[i].overlaps) {
+        row0 = std::min(row0, bounds[i].row0);
+        row1 = std::max(row1, bounds[i].row1);
+      }
+    }
+    boost::scoped_ptr<SourceWindow<T, TLayout> > source;
+    if (row0 < row1) {
+      source.reset(new SourceWindow<T, TLayout>(req, row0, row1));
+    }
+
+    // The targets are mapped a chunk at a time to stay clear of the
+    // per-process limits on open files and mappings.
+    for (size_t chunk = 0; chunk < targets.size(); chunk += MAX_MAPPED_TILES) {
+      size_t chunkEnd = std::min(targets.size(), chunk + MAX_MAPPED_TILES);
+
+      boost::ptr_vector<MMFile<T> > to_f;
+      boost::ptr_vector<Grid<T> > to_g;
+      std::vector<ProjectionTile<T> > tiles;
+      for (size_t i = chunk; i < chunkEnd; i++) {
+        if (targets.data.empty()) {
+          to_f.push_back(new MMFile<T>(targets.to[i], boost::interprocess::read_write));
+          to_g.push_back(new Grid<T>(to_f.back().begin(), to_f.back().end(), req.toStride, req.toRows, req.toCols,
+            req.bands, req.order));
+        } else {
+          T* data = reinterpret_cast<T*>(targets.data[i]);
+          to_g.push_back(new Grid<T>(data, data + req.toRows * req.toStride * req.bands,
+            req.toStride, req.toRows, req.toCols, req.bands, req.order));
+        }
+        to_g.back().setNodata(NoData<T>(req.toNA));
+        if (bounds[i].overlaps) {
+          source->willNeed(req, bounds[i]);
+          tiles.push_back(ProjectionTile<T>(&to_g.back(), targets.x[i], targets.y[i]));
+        } else {
+          fill_grid(to_g.back());
+        }
+      }
+
+      if (!tiles.empty()) {
+        project_tiles<T>(proj, interp, source->grid(), req.lat1, req.lat2, req.lng1, req.lng2,
+          tiles, req.totalWidth, req.totalHeight, req.blockSize);
+      }
+    }
+  }
+};
+
+// The tile cache key for the tile at x, y; empty if the tile shouldn't be
+// cached. Covers everything that the tile's contents depend on.
+std::string tile_cache_key(const ProjectionRequest& req, int x, int y) {
+  if (!tileCache().enabled()) {
+    return std::string();
+  }
+  std::string source = req.pSource ? req.pSource->identity : fileIdentity(req.from);
+  if (source.empty()) {
+    return std::string();
+  }
+  std::ostringstream key;
+  key << source << '\n' << req.name << '\n' << req.method << '\n' << req.dataFormat
+      << '\n' << req.bands << ' ' << req.order << ' ' << req.swapBytes
+      << '\n' << req.fromStride << ' ' << req.fromRows << ' ' << req.fromCols
+      << '\n' << req.lng1 << ' ' << req.lng2 << ' ' << req.lat1 << ' ' << req.lat2
+      << '\n' << req.toStride << ' ' << req.toRows << ' ' << req.toCols
+      << '\n' << req.totalWidth << ' ' << req.totalHeight
+      << '\n' << x << ' ' << y
+      << '\n' << std::setprecision(17) << req.fromNA << ' ' << req.toNA;
+  return key.str();
+}
+
+// Copies a cached tile into an output file. Returns false if the file isn't
+// the same size as the tile.
+bool copy_cached_tile(const std::vector<char>& data, const std::string& path) {
+  MMFile<char> f(path, boost::interprocess::read_write);
+  if (static_cast<size_t>(f.end() - f.begin()) != data.size()) {
+    return false;
+  }
+  std::copy(data.begin(), data.end(), f.begin());
+  return true;
+}
+
+TileCache::data_ptr read_tile(const std::string& path) {
+  MMFile<char> f(path, boost::interprocess::read_only);
+  return TileCache::data_ptr(new std::vector<char>(f.begin(), f.end()));
+}
+
+// Reads the source from source, if it's an open raster (see
+// openRasterSource), rather than mapping the file named by req.from. The open
+// raster's layout then stands in for the one given in req.
+void use_open_source(ProjectionRequest* req, SEXP source) {
+  req->pSource = getRasterSource(source);
+  if (req->pSource) {
+    const RasterSource& src = *req->pSource;
+    req->from = src.path;
+    req->dataFormat = src.dataFormat;
+    req->fromStride = src.stride;
+    req->fromRows = src.rows;
+    req->fromCols = src.cols;
+    req->bands = src.bands;
+    req->order = src.order;
+    req->tiled = src.tiled;
+    req->swapBytes = src.swapBytes;
+  }
+}
+
+// Projects into a batch of equally sized tiles: to, x and y have one element
+// per tile. Tiles found in the tile cache are copied from it; the rest are
+// rendered and then added to it. The source has the given number of bands,
+// laid out in bandOrder ("BIL", "BIP" or "BSQ"), and so do the tiles. The
+// source's cells are in byteOrder ("little" or "big"); the tiles' are in
+// the host's byte order. from is a tiled copy of the source (see
+// retile_file) if tiled is set. source is NULL, or an open raster to read
+// instead of from (see use_open_source). fromNA and toNA are the nodata values of
+// the source and the tiles (see ProjectionRequest).
+// [[Rcpp::export]]
+void do_project_tiles(
+    const std::string& name,
+    const std::string& from, bool tiled, SEXP source,
+    int fromStride, int fromRows, int fromCols,
+    double fromNA,
+    int lng1, int lng2, int lat1, int lat2,
+    const std::vector<std::string>& to, int toStride, int toRows, int toCols,
+    double toNA,
+    const std::vector<int>& x, const std::vector<int>& y, int totalWidth, int totalHeight,
+    int bands, const std::string& bandOrder,
+    const std::string& dataFormat, const std::string& byteOrder,
+    const std::string& method,
+    int blockSize
+) {
+  if (blockSize <= 0) {
+    Rcpp::stop("blockSize must be positive");
+  }
+  if (x.size() != to.size() || y.size() != to.size()) {
+    Rcpp::stop("Need exactly one x and y origin per output file");
+  }
+  if (bands <= 0) {
+    Rcpp::stop("bands must be positive");
+  }
+  BandOrder order;
+  if (!parseBandOrder(bandOrder, &order)) {
+    Rcpp::stop("Unknown band order: %s", bandOrder);
+  }
+  bool swap;
+  if (!parseByteOrder(byteOrder, &swap)) {
+    Rcpp::stop("Unknown byte order: %s", byteOrder);
+  }
+
+  ProjectionRequest req = {name, method, dataFormat,
+    from, to_index(fromStride, "fromStride"), to_index(fromRows, "fromRows"),
+    to_index(fromCols, "fromCols"),
+    lng1, lng2, lat1, lat2,
+    to_index(toStride, "toStride"), to_index(toRows, "toRows"), to_index(toCols, "toCols"),
+    to_index(totalWidth, "totalWidth"), to_index(totalHeight, "totalHeight"),
+    to_index(blockSize, "blockSize"),
+    to_index(bands, "bands"), order, tiled, swap, fromNA, toNA, NULL};
+  use_open_source(&req, source);
+
+  TileCache& cache = tileCache();
+  std::vector<std::string> keys;
+  TileTargets misses;
+  for (size_t i = 0; i < to.size(); i++) {
+    std::string key = tile_cache_key(req, x[i], y[i]);
+
+    TileCache::data_ptr data;
+    if (!key.empty() && cache.get(key, &data) && copy_cached_tile(*data, to[i])) {
+      continue;
+    }
+    keys.push_back(key);
+    misses.to.push_back(to[i]);
+    misses.x.push_back(x[i]);
+    misses.y.push_back(y[i]);
+  }
+
+  if (!misses.to.empty()) {
+    dispatch_format<ProjectTiles>(req, misses);
+    for (size_t i = 0; i < misses.to.size(); i++) {
+      if (!keys[i].empty()) {
+        cache.put(keys[i], read_tile(misses.to[i]));
+      }
+    }
+  }
+}
+
+// Sets the byte budget of the tile cache if budget is not negative (0
+// disables it), and reports its counters.
+// [[Rcpp::export]]
+NumericVector tile_cache_stats(double budget) {
+  if (budget >= 0) {
+    tileCache().setBudget(static_cast<size_t>(budget));
+  }
+  TileCache::Stats s = tileCache().stats();
+  return NumericVector::create(
+    _["hits"] = s.hits, _["misses"] = s.misses, _["evictions"] = s.evictions,
+    _["entries"] = s.entries, _["bytes"] = s.bytes, _["budget"] = s.budget);
+}
+
+// Tiles to be rendered into R vectors: tile i is at x[i], y[i], and its
+// values go to values[i] (see copy_values).
+struct ValueTiles {
+  std::vector<int> x, y;
+  std::vector<double*> values;
+  double nodata;
+};
+
+// Projects tiles into memory (or copies them from the tile cache), and
+// copies their values out.
+template <class T>
+class ProjectToValues {
+  const ProjectionRequest& req;
+  const ValueTiles& tiles;
+
+public:
+  ProjectToValues(const ProjectionRequest& req, const ValueTiles& tiles) :
+    req(req), tiles(tiles) {
+  }
+
+  template <class TProj, class TInterp>
+  void operator()(const TProj& proj, const TInterp& interp) const {
+    size_t ncell = req.toRows * req.toStride * req.bands;
+    // Byte buffers rather than std::vector<T>s, which don't work for bool
+    std::vector<std::vector<char> > buffers(tiles.x.size(),
+      std::vector<char>(ncell * sizeof(T)));
+
+    TileCache& cache = tileCache();
+    std::vector<std::string> keys;
+    TileTargets misses;
+    for (size_t i = 0; i < buffers.size(); i++) {
+      std::string key = tile_cache_key(req, tiles.x[i], tiles.y[i]);
+      TileCache::data_ptr cached;
+      if (!key.empty() && cache.get(key, &cached) && cached->size() == buffers[i].size()) {
+        std::memcpy(&buffers[i][0], &(*cached)[0], buffers[i].size());
+        continue;
+      }
+      keys.push_back(key);
+      misses.data.push_back(&buffers[i][0]);
+      misses.x.push_back(tiles.x[i]);
+      misses.y.push_back(tiles.y[i]);
+    }
+
+    if (misses.size() > 0) {
+      ProjectTiles<T>(req, misses)(proj, interp);
+      for (size_t i = 0; i < misses.size(); i++) {
+        if (!keys[i].empty()) {
+          cache.put(keys[i], TileCache::data_ptr(new std::vector<char>(
+            misses.data[i], misses.data[i] + ncell * sizeof(T))));
+        }
+      }
+    }
+
+    for (size_t i = 0; i < buffers.size(); i++) {
+      T* data = reinterpret_cast<T*>(&buffers[i][0]);
+      Grid<T> tile(data, data + ncell, req.toStride, req.toRows, req.toCols,
+        req.bands, req.order);
+      copy_values(tile, tiles.nodata, tiles.values[i]);
+    }
+  }
+};
+
+// Like do_project_tiles, but returns the tiles' values instead of writing
+// them to files: a list with a vector per tile, in the order of a Raster
+// object's values (see copy_values). Source cells with the nodata value, and
+// tile cells without any source data, become NA.
+// [[Rcpp::export]]
+List do_project_values(
+    const std::string& name,
+    const std::string& from, bool tiled, SEXP source,
+    int fromStride, int fromRows, int fromCols,
+    int lng1, int lng2, int lat1, int lat2,
+    int toRows, int toCols,
+    const std::vector<int>& x, const std::vector<int>& y, int totalWidth, int totalHeight,
+    int bands, const std::string& bandOrder,
+    const std::string& dataFormat, const std::string& byteOrder,
+    const std::string& method,
+    int blockSize, double nodata
+) {
+  if (blockSize <= 0) {
+    Rcpp::stop("blockSize must be positive");
+  }
+  if (y.size() != x.size()) {
+    Rcpp::stop("Need exactly one y origin per x origin");
+  }
+  if (toRows <= 0 || toCols <= 0) {
+    Rcpp::stop("Tiles must have at least one cell");
+  }
+  if (bands <= 0) {
+    Rcpp::stop("bands must be positive");
+  }
+  BandOrder order;
+  if (!parseBandOrder(bandOrder, &order)) {
+    Rcpp::stop("Unknown band order: %s", bandOrder);
+  }
+  bool swap;
+  if (!parseByteOrder(byteOrder, &swap)) {
+    Rcpp::stop("Unknown byte order: %s", byteOrder);
+  }
+
+  ProjectionRequest req = {name, method, dataFormat,
+    from, to_index(fromStride, "fromStride"), to_index(fromRows, "fromRows"),
+    to_index(fromCols, "fromCols"),
+    lng1, lng2, lat1, lat2,
+    to_index(toCols, "toCols"), to_index(toRows, "toRows"), to_index(toCols, "toCols"),
+    to_index(totalWidth, "totalWidth"), to_index(totalHeight, "totalHeight"),
+    to_index(blockSize, "blockSize"),
+    to_index(bands, "bands"), order, tiled, swap, nodata, nodata, NULL};
+  use_open_source(&req, source);
+
+  // The vectors are allocated here, as R can't be called from the workers
+  List result(x.size());
+  ValueTiles tiles = {x, y, std::vector<double*>(x.size()), nodata};
+  for (size_t i = 0; i < x.size(); i++) {
+    NumericVector values(static_cast<R_xlen_t>(toRows) * toCols * req.bands);
+    tiles.values[i] = values.begin();
+    result[i] = values;
+  }
+  if (!x.empty()) {
+    dispatch_format<ProjectToValues>(req, tiles);
+  }
+  return result;
+}
+
+// A tile to be rendered straight to PNG, and how to color it.
+struct PngTile {
+  int x, y;
+  const ColorRamp* pRamp;
+  double lo, hi;
+  uint32_t naColor;
+  int compression;
+  std::vector<unsigned char>* pOut;
+};
+
+// Projects a tile into memory (or copies it from the tile cache), colors it
+// and encodes it as PNG.
+template <class T>
+class ProjectToPNG {
+  const ProjectionRequest& req;
+  const PngTile& tile;
+
+public:
+  ProjectToPNG(const ProjectionRequest& req, const PngTile& tile) :
+    req(req), tile(tile) {
+  }
+
+  template <class TProj, class TInterp>
+  void operator()(const TProj& proj, const TInterp& interp) const {
+    size_t ncell = req.toRows * req.toCols;
+    // A byte buffer rather than a std::vector<T>, which doesn't work for bool
+    std::vector<char> buffer(ncell * sizeof(T));
+    T* values = reinterpret_cast<T*>(&buffer[0]);
+
+    std::string key = tile_cache_key(req, tile.x, tile.y);
+    TileCache::data_ptr cached;
+    if (!key.empty() && tileCache().get(key, &cached) && cached->size() == buffer.size()) {
+      std::memcpy(values, &(*cached)[0], buffer.size());
+    } else {
+      Grid<T> to_g(values, values + ncell, req.toCols, req.toRows, req.toCols);
+      to_g.setNodata(NoData<T>(req.toNA));
+      SourceBounds bounds = tile_source_bounds(req, proj, tile.x, tile.y);
+      if (!bounds.overlaps) {
+        fill_grid(to_g);
+      } else if (req.tiled) {
+        render<Tiled>(proj, interp, bounds, to_g);
+      } else {
+        render<RowMajor>(proj, interp, bounds, to_g);
+      }
+
+      if (!key.empty()) {
+        tileCache().put(key, TileCache::data_ptr(new std::vector<char>(buffer)));
+      }
+    }
+
+    std::vector<uint32_t> pixels(ncell);
+    ColorizeWorker<T> worker(values, NoData<T>(req.toNA), tile.pRamp, tile.lo, tile.hi, tile.naColor, &pixels[0]);
+    RcppParallel::parallelFor(0, ncell, worker, 4096);
+
+    encode_png(&pixels[0], req.toCols, req.toRows, tile.compression, tile.pOut);
+  }
+
+private:
+  // Projects from a source of the given layout into to_g
+  template <class TLayout, class TProj, class TInterp>
+  void render(const TProj& proj, const TInterp& interp,
+    const SourceBounds& bounds, const Grid<T>& to_g) const {
+
+    SourceWindow<T, TLayout> source(req, bounds.row0, bounds.row1);
+    source.willNeed(req, bounds);
+    project<T>(proj, interp, source.grid(), req.lat1, req.lat2, req.lng1, req.lng2,
+      to_g, tile.x, req.totalWidth, tile.y, req.totalHeight, req.blockSize);
+  }
+};
+
+// Renders a single tile and returns it as PNG, without going through files or
+// R vectors. Values from lo to hi are mapped onto the color ramp given by
+// colors (a col2rgb(alpha = TRUE) matrix), precomputed at tableSize points
+// (0 computes every color exactly); everything else gets naColor (red, green,
+// blue and alpha), and so do missing cells, i.e. those with the source's
+// nodata value, fromNA. source and byteOrder are as for do_project_tiles,
+// and the source must have a single band.
+// [[Rcpp::export]]
+RawVector do_project_png(
+    const std::string& name,
+    const std::string& from, bool tiled, SEXP source,
+    int fromStride, int fromRows, int fromCols,
+    double fromNA,
+    int lng1, int lng2, int lat1, int lat2,
+    int width, int height,
+    int x, int y, int totalWidth, int totalHeight,
+    const std::string& dataFormat, const std::string& byteOrder,
+    const std::string& method,
+    int blockSize,
+    const std::vector<double>& colors, double lo, double hi,
+    const std::vector<int>& naColor, int tableSize, int compression
+) {
+  if (blockSize <= 0) {
+    Rcpp::stop("blockSize must be positive");
+  }
+  if (colors.empty() || colors.size() % 4 != 0) {
+    Rcpp::stop("colors must have four rows (red, green, blue and alpha)");
+  }
+  if (naColor.size() != 4) {
+    Rcpp::stop("naColor must have four elements (red, green, blue and alpha)");
+  }
+  bool swap;
+  if (!parseByteOrder(byteOrder, &swap)) {
+    Rcpp::stop("Unknown byte order: %s", byteOrder);
+  }
+
+  ProjectionRequest req = {name, method, dataFormat,
+    from, to_index(fromStride, "fromStride"), to_index(fromRows, "fromRows"),
+    to_index(fromCols, "fromCols"),
+    lng1, lng2, lat1, lat2,
+    to_index(width, "width"), to_index(height, "height"), to_index(width, "width"),
+    to_index(totalWidth, "totalWidth"), to_index(totalHeight, "totalHeight"),
+    to_index(blockSize, "blockSize"),
+    1, BAND_BIL, tiled, swap, fromNA, fromNA, NULL};
+  use_open_source(&req, source);
+  if (req.bands != 1) {
+    Rcpp::stop("Can only render single-band rasters as PNG");
+  }
+
+  ColorRamp ramp(&colors[0], colors.size() / 4, true, std::max(tableSize, 0));
+  unsigned char na[4];
+  for (int i = 0; i < 4; i++) {
+    na[i] = static_cast<unsigned char>(naColor[i]);
+  }
+  std::vector<unsigned char> png;
+  PngTile tile = {x, y, &ramp, lo, hi, packRGBA(na), compression, &png};
+
+  dispatch_format<ProjectToPNG>(req, tile);
+
+  return RawVector(png.begin(), png.end());
+}
@@ -2,7 +2,11 @@
 #define PROJECT_ALGOS_HPP
 
 #include <cmath>
+#include <limits>
+#include <map>
+#include <vector>
 
+#include <boost/type_traits/integral_constant.hpp>
 #include <RcppParallel.h>
 
 #include "grid.hpp"
@@ -10,30 +14,44 @@
 
 using namespace Rcpp;
 
-template <class T>
-class Projection {
-public:
-  virtual ~Projection() {}
-
-  virtual void reverse(double x, double y, double* lng, double* lat) = 0;
-};
+// Projections are policy classes: workers are instantiated for a specific
+// projection type so that reverse() can be inlined into the per-pixel loop.
+// Every projection provides
+//
+//   static const bool separable;
+//   void reverse(double x, double y, double* lng, double* lat) const;
+//
+// A projection is separable if longitude depends only on x and latitude only
+// on y. Separable projections also provide reverseX and reverseY, so callers
+// can tabulate longitudes per column and latitudes per row instead of calling
+// reverse for every pixel.
 
-template <class T>
-class WebMercatorProjection : public Projection<T> {
+class WebMercatorProjection {
 public:
+  static const bool separable = true;
+
   // Reverse-project x and y values (between 0 and 1) to lng/lat in degrees.
-  void reverse(double x, double y, double* lng, double* lat) {
-    *lng = x * 360 - 180;
+  void reverse(double x, double y, double* lng, double* lat) const {
+    *lng = reverseX(x);
+    *lat = reverseY(y);
+  }
+
+  double reverseX(double x) const {
+    return x * 360 - 180;
+  }
+
+  double reverseY(double y) const {
     double lat_rad = atan(sinh(PI * (1 - 2*y)));
-    *lat = lat_rad * 180 / PI;
+    return lat_rad * 180 / PI;
   }
 };
 
-template <class T>
-class MollweideProjection : public Projection<T> {
+class MollweideProjection {
 public:
+  static const bool separable = false;
+
   // Reverse-project x and y values (between 0 and 1) to lng/lat in degrees.
-  void reverse(double x, double y, double* lng, double* lat) {
+  void reverse(double x, double y, double* lng, double* lat) const {
     // From Wikipedia.
     const double R = 1;
     const double lambda0 = 0;
@@ -52,61 +70,342 @@ public:
   }
 };
 
+// Fills every band of a target cell with na, the target's NoData::na(), for
+// cells outside the source.
+template <class T>
+inline void fill_bands(T* out, index_t bands, index_t bandStep, T na) {
+  for (index_t b = 0; b < bands; b++) {
+    out[b * bandStep] = na;
+  }
+}
+
+// Fills every cell of a target with NA, for targets that lie entirely
+// outside the source.
 template <class T>
+inline void fill_grid(const Grid<T>& tgt) {
+  T na = tgt.nodata().na();
+  for (index_t y = 0; y < tgt.nrow(); y++) {
+    T* out = tgt.at(y, 0);
+    for (index_t x = 0; x < tgt.ncol(); x++, out += tgt.colStep()) {
+      fill_bands(out, tgt.nband(), tgt.bandStep(), na);
+    }
+  }
+}
+
+// One output of a projection. All tiles projected together must have the same
+// dimensions, and as many bands as the source; each sits at xOrigin, yOrigin
+// within the projected world (see project()).
+template <class T>
+struct ProjectionTile {
+  const Grid<T>* pTgt;
+  index_t xOrigin, yOrigin;
+
+  ProjectionTile(const Grid<T>* pTgt, index_t xOrigin, index_t yOrigin) :
+    pTgt(pTgt), xOrigin(xOrigin), yOrigin(yOrigin) {
+  }
+};
+
+// The source may have any layout (see Grid); the targets are row-major.
+template <class T, class TInterp, class TProj, class TLayout>
 class ProjectionWorker : public RcppParallel::Worker {
-  Projection<T>* pProj;
-  Interpolator<T>* pInterp;
-  const Grid<T>* pSrc;
+  const TProj proj;
+  const TInterp interp;
+  const Grid<T, TLayout>* pSrc;
   double lat1, lat2, lng1, lng2;
-  const Grid<T>* pTgt;
-  index_t xOrigin, xTotal, yOrigin, yTotal;
+  const std::vector<ProjectionTile<T> >* pTiles;
+  index_t xTotal, yTotal;
+  const GridBlocks* pBlocks;
 
 public:
-  ProjectionWorker(Projection<T>* pProj, Interpolator<T>* pInterp,
-    const Grid<T>* pSrc, double lat1, double lat2, double lng1, double lng2,
-    const Grid<T>* pTgt, index_t xOrigin, index_t xTotal, index_t yOrigin, index_t yTotal
-  ) : pProj(pProj), pInterp(pInterp), pSrc(pSrc), lat1(lat1), lat2(lat2), lng1(lng1), lng2(lng2),
-      pTgt(pTgt), xOrigin(xOrigin), xTotal(xTotal), yOrigin(yOrigin), yTotal(yTotal) {
+  ProjectionWorker(const TProj& proj, const TInterp& interp,
+    const Grid<T, TLayout>* pSrc, double lat1, double lat2, double lng1, double lng2,
+    const std::vector<ProjectionTile<T> >* pTiles, index_t xTotal, index_t yTotal,
+    const GridBlocks* pBlocks
+  ) : proj(proj), interp(interp), pSrc(pSrc), lat1(lat1), lat2(lat2), lng1(lng1), lng2(lng2),
+      pTiles(pTiles), xTotal(xTotal), yTotal(yTotal), pBlocks(pBlocks) {
   }
 
+  // begin and end number the blocks of all tiles, tile by tile
   void operator()(size_t begin, size_t end) {
     for (size_t i = begin; i < end; i++) {
-      size_t x = i / pTgt->nrow();
-      size_t y = i % pTgt->nrow();
+      const ProjectionTile<T>& tile = (*pTiles)[i / pBlocks->size()];
+      index_t row0, row1, col0, col1;
+      pBlocks->bounds(i % pBlocks->size(), &row0, &row1, &col0, &col1);
+
+      index_t colStep = tile.pTgt->colStep(), bandStep = tile.pTgt->bandStep();
+      T na = tile.pTgt->nodata().na();
 
-      double lng, lat;
+      for (index_t y = row0; y < row1; y++) {
+        double yNorm = (static_cast<double>(y) + tile.yOrigin) / yTotal;
+        T* out = tile.pTgt->at(y, col0);
 
-      double xNorm = (static_cast<double>(x) + xOrigin) / xTotal;
-      double yNorm = (static_cast<double>(y) + yOrigin) / yTotal;
+        for (index_t x = col0; x < col1; x++, out += colStep) {
+          double lng, lat;
 
-      pProj->reverse(xNorm, yNorm, &lng, &lat);
+          double xNorm = (static_cast<double>(x) + tile.xOrigin) / xTotal;
 
-      double srcXNorm = (lng - lng1) / (lng2 - lng1);
-      double srcYNorm = 1 - (lat - lat1) / (lat2 - lat1);
+          proj.reverse(xNorm, yNorm, &lng, &lat);
 
-      if (srcXNorm >= 0 && srcXNorm < 1 && srcYNorm >= 0 && srcYNorm < 1) {
-        *pTgt->at(y, x) = pInterp->getValue(*pSrc,
-          srcXNorm * pSrc->ncol(),
-          srcYNorm * pSrc->nrow());
-      } else {
-        // The data lies outside of the bounds of the source image; use
-        // NA as the value
-        *pTgt->at(y, x) = -std::numeric_limits<double>::max();
+          double srcXNorm = (lng - lng1) / (lng2 - lng1);
+          double srcYNorm = 1 - (lat - lat1) / (lat2 - lat1);
+
+          if (srcXNorm >= 0 && srcXNorm < 1 && srcYNorm >= 0 && srcYNorm < 1) {
+            interp.getValues(*pSrc,
+              srcXNorm * pSrc->ncol(),
+              srcYNorm * pSrc->nrow(), out, bandStep, na);
+          } else {
+            // The data lies outside of the bounds of the source image; use
+            // NA as the value
+            fill_bands(out, pSrc->nband(), bandStep, na);
+          }
+        }
       }
+    }
+  }
+};
+
+// Source coordinates for one axis of the target, as computed from a separable
+// projection. pos is in source pixels; valid is false where the target
+// index falls outside of the source's extent.
+struct ProjectedAxis {
+  std::vector<double> pos;
+  std::vector<char> valid;
+
+  explicit ProjectedAxis(index_t n) : pos(n), valid(n) {
+  }
+};
+
+// Used instead of ProjectionWorker when the projection is separable. The
+// reverse projection has already been done once per row and once per column;
+// all that's left per pixel is the interpolation.
+template <class T, class TInterp, class TLayout>
+class SeparableProjectionWorker : public RcppParallel::Worker {
+  const TInterp interp;
+  const Grid<T, TLayout>* pSrc;
+  const std::vector<ProjectionTile<T> >* pTiles;
+  // The column and row tables of each tile; tiles in the same tile column or
+  // row share them.
+  const std::vector<const ProjectedAxis*>* pCols;
+  const std::vector<const ProjectedAxis*>* pRows;
+  const GridBlocks* pBlocks;
+
+public:
+  SeparableProjectionWorker(const TInterp& interp, const Grid<T, TLayout>* pSrc,
+    const std::vector<ProjectionTile<T> >* pTiles,
+    const std::vector<const ProjectedAxis*>* pCols,
+    const std::vector<const ProjectedAxis*>* pRows,
+    const GridBlocks* pBlocks
+  ) : interp(interp), pSrc(pSrc), pTiles(pTiles), pCols(pCols), pRows(pRows),
+      pBlocks(pBlocks) {
+  }
+
+  // begin and end number the blocks of all tiles, tile by tile
+  void operator()(size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+      size_t t = i / pBlocks->size();
+      const Grid<T>* pTgt = (*pTiles)[t].pTgt;
+      const ProjectedAxis* pRowAxis = (*pRows)[t];
+      const char* colValid = &(*pCols)[t]->valid[0];
+      const double* colPos = &(*pCols)[t]->pos[0];
+
+      index_t row0, row1, col0, col1;
+      pBlocks->bounds(i % pBlocks->size(), &row0, &row1, &col0, &col1);
 
+      index_t colStep = pTgt->colStep(), bandStep = pTgt->bandStep();
+      T na = pTgt->nodata().na();
+
+      for (index_t y = row0; y < row1; y++) {
+        T* out = pTgt->at(y, col0);
+        bool rowValid = pRowAxis->valid[y];
+        double srcY = pRowAxis->pos[y];
+
+        for (index_t x = col0; x < col1; x++, out += colStep) {
+          if (rowValid && colValid[x]) {
+            interp.getValues(*pSrc, colPos[x], srcY, out, bandStep, na);
+          } else {
+            // The data lies outside of the bounds of the source image; use
+            // NA as the value
+            fill_bands(out, pSrc->nband(), bandStep, na);
+          }
+        }
+      }
     }
   }
 };
 
-template <class T>
-boost::shared_ptr<Projection<T> > getProjection(const std::string& name) {
-  if (name == "epsg:3857") {
-    return boost::shared_ptr<Projection<T> >(new WebMercatorProjection<T>());
-  } else if (name == "mollweide") {
-    return boost::shared_ptr<Projection<T> >(new MollweideProjection<T>());
-  } else {
-    return boost::shared_ptr<Projection<T> >();
+// Source column positions for the ncol target columns starting at xOrigin.
+template <class TProj>
+ProjectedAxis project_columns(const TProj& proj, index_t srcCols,
+  double lng1, double lng2, index_t ncol, index_t xOrigin, index_t xTotal) {
+
+  ProjectedAxis cols(ncol);
+  for (index_t x = 0; x < ncol; x++) {
+    double lng = proj.reverseX((static_cast<double>(x) + xOrigin) / xTotal);
+    double srcXNorm = (lng - lng1) / (lng2 - lng1);
+    cols.valid[x] = srcXNorm >= 0 && srcXNorm < 1;
+    cols.pos[x] = srcXNorm * srcCols;
+  }
+  return cols;
+}
+
+// Source row positions for the nrow target rows starting at yOrigin.
+template <class TProj>
+ProjectedAxis project_rows(const TProj& proj, index_t srcRows,
+  double lat1, double lat2, index_t nrow, index_t yOrigin, index_t yTotal) {
+
+  ProjectedAxis rows(nrow);
+  for (index_t y = 0; y < nrow; y++) {
+    double lat = proj.reverseY((static_cast<double>(y) + yOrigin) / yTotal);
+    double srcYNorm = 1 - (lat - lat1) / (lat2 - lat1);
+    rows.valid[y] = srcYNorm >= 0 && srcYNorm < 1;
+    rows.pos[y] = srcYNorm * srcRows;
+  }
+  return rows;
+}
+
+// Separable projections: tabulate the reverse projection per column and per
+// row, then interpolate. Same arithmetic as ProjectionWorker, but done once
+// per column and once per row rather than once per pixel. The tables only
+// depend on a tile's origin, so each distinct xOrigin and yOrigin in the batch
+// is tabulated once.
+template <class T, class TInterp, class TProj, class TLayout>
+void project_blocks(const TProj& proj, const TInterp& interp,
+  const Grid<T, TLayout>& src, double lat1, double lat2, double lng1, double lng2,
+  const std::vector<ProjectionTile<T> >& tiles, index_t xTotal, index_t yTotal,
+  const GridBlocks& blocks, boost::true_type) {
+
+  index_t ncol = tiles[0].pTgt->ncol();
+  index_t nrow = tiles[0].pTgt->nrow();
+
+  std::vector<ProjectedAxis> colTables, rowTables;
+  std::map<index_t, size_t> colIndex, rowIndex;
+  for (size_t t = 0; t < tiles.size(); t++) {
+    if (colIndex.find(tiles[t].xOrigin) == colIndex.end()) {
+      colIndex[tiles[t].xOrigin] = colTables.size();
+      colTables.push_back(project_columns(proj, src.ncol(), lng1, lng2,
+        ncol, tiles[t].xOrigin, xTotal));
+    }
+    if (rowIndex.find(tiles[t].yOrigin) == rowIndex.end()) {
+      rowIndex[tiles[t].yOrigin] = rowTables.size();
+      rowTables.push_back(project_rows(proj, src.nrow(), lat1, lat2,
+        nrow, tiles[t].yOrigin, yTotal));
+    }
+  }
+
+  std::vector<const ProjectedAxis*> cols(tiles.size()), rows(tiles.size());
+  for (size_t t = 0; t < tiles.size(); t++) {
+    cols[t] = &colTables[colIndex[tiles[t].xOrigin]];
+    rows[t] = &rowTables[rowIndex[tiles[t].yOrigin]];
+  }
+
+  SeparableProjectionWorker<T, TInterp, TLayout> worker(interp, &src, &tiles,
+    &cols, &rows, &blocks);
+  RcppParallel::parallelFor(0, tiles.size() * blocks.size(), worker);
+}
+
+// Non-separable projections: reverse-project every pixel.
+template <class T, class TInterp, class TProj, class TLayout>
+void project_blocks(const TProj& proj, const TInterp& interp,
+  const Grid<T, TLayout>& src, double lat1, double lat2, double lng1, double lng2,
+  const std::vector<ProjectionTile<T> >& tiles, index_t xTotal, index_t yTotal,
+  const GridBlocks& blocks, boost::false_type) {
+
+  ProjectionWorker<T, TInterp, TProj, TLayout> worker(
+      proj, interp, &src, lat1, lat2, lng1, lng2,
+      &tiles, xTotal, yTotal, &blocks);
+  RcppParallel::parallelFor(0, tiles.size() * blocks.size(), worker);
+}
+
+// Finds the source cells that projecting into a nrow-by-ncol tile at
+// xOrigin, yOrigin can read: rows [*row0, *row1) and columns [*col0,
+// *col1) of a srcRows-by-srcCols source. Returns false if the tile doesn't
+// overlap the source at all. Only the tile's edges are reverse-projected,
+// which gives the exact bounds as long as the source coordinates of the
+// cells inside a tile lie between those of its edges; this holds for both
+// projections, as latitude only depends on y and longitude changes
+// monotonically along each row.
+template <class TProj>
+bool source_bounds(const TProj& proj, index_t srcRows, index_t srcCols,
+  double lat1, double lat2, double lng1, double lng2,
+  index_t nrow, index_t ncol, index_t xOrigin, index_t yOrigin,
+  index_t xTotal, index_t yTotal,
+  index_t* row0, index_t* row1, index_t* col0, index_t* col1) {
+
+  double xlo = std::numeric_limits<double>::infinity(), xhi = -xlo;
+  double ylo = xlo, yhi = -xlo;
+  for (index_t i = 0; i < 2 * (nrow + ncol); i++) {
+    // Top and bottom rows, then left and right columns
+    index_t x, y;
+    if (i < 2 * ncol) {
+      x = i % ncol;
+      y = i < ncol ? 0 : nrow - 1;
+    } else {
+      x = i < 2 * ncol + nrow ? 0 : ncol - 1;
+      y = (i - 2 * ncol) % nrow;
+    }
+
+    double lng, lat;
+    proj.reverse((static_cast<double>(x) + xOrigin) / xTotal,
+      (static_cast<double>(y) + yOrigin) / yTotal, &lng, &lat);
+    // Same arithmetic as the workers. Cells whose reverse projection is
+    // undefined (NaN) read nothing.
+    double srcX = (lng - lng1) / (lng2 - lng1) * srcCols;
+    double srcY = (1 - (lat - lat1) / (lat2 - lat1)) * srcRows;
+    if (srcX == srcX && srcY == srcY) {
+      xlo = std::min(xlo, srcX);
+      xhi = std::max(xhi, srcX);
+      ylo = std::min(ylo, srcY);
+      yhi = std::max(yhi, srcY);
+    }
+  }
+
+  // Cells outside the source read nothing, and each cell inside reads at
+  // most the source cells at floor(pos) and floor(pos) + 1 (see Bilinear
+  // and NearestNeighbor). The bounds are a cell wider on each side than
+  // that, in case rounding makes a cell inside the tile land just beyond
+  // its edges, as callers may rely on nothing outside them being read.
+  if (!(xhi >= 0 && xlo < srcCols && yhi >= 0 && ylo < srcRows)) {
+    return false;
+  }
+  *col0 = static_cast<index_t>(std::max(std::floor(xlo) - 1, 0.0));
+  *col1 = static_cast<index_t>(std::min<double>(std::floor(xhi) + 3, srcCols));
+  *row0 = static_cast<index_t>(std::max(std::floor(ylo) - 1, 0.0));
+  *row1 = static_cast<index_t>(std::min<double>(std::floor(yhi) + 3, srcRows));
+  return true;
+}
+
+/**
+ * Project the given WGS84 data into a batch of equally sized tiles. The
+ * blocks of all tiles are scheduled together, so a batch of small tiles keeps
+ * every worker thread busy.
+ *
+ * @param tiles The targets and their origins; see project() for the meaning
+ *   of the other parameters.
+ */
+template <class T, class TInterp, class TProj, class TLayout>
+void project_tiles(const TProj& proj, const TInterp& interp,
+  const Grid<T, TLayout>& src, double lat1, double lat2, double lng1, double lng2,
+  const std::vector<ProjectionTile<T> >& tiles, index_t xTotal, index_t yTotal,
+  index_t blockSize = DEFAULT_BLOCK_SIZE) {
+
+  if (tiles.empty()) {
+    return;
   }
+  index_t nrow = tiles[0].pTgt->nrow();
+  index_t ncol = tiles[0].pTgt->ncol();
+  for (size_t t = 0; t < tiles.size(); t++) {
+    if (tiles[t].pTgt->nrow() != nrow || tiles[t].pTgt->ncol() != ncol) {
+      Rcpp::stop("All tiles in a batch must have the same dimensions");
+    }
+    if (tiles[t].pTgt->nband() != src.nband()) {
+      Rcpp::stop("Tiles must have as many bands as the source");
+    }
+  }
+
+  GridBlocks blocks(nrow, ncol, blockSize);
+  project_blocks(proj, interp, src, lat1, lat2, lng1, lng2,
+    tiles, xTotal, yTotal, blocks,
+    boost::integral_constant<bool, TProj::separable>());
 }
 
 /**
@@ -115,27 +414,31 @@ boost::shared_ptr<Projection<T> > getProjection(const std::string& name) {
  * portion of the projected data (i.e. you can make a map tile without
  * projecting the entire map first).
  *
+ * @param proj The projection implementation to use.
  * @param interp The interpolation implementation to use.
  * @param src The source of the WGS84 data; may or may not be a complete
- *   360-by-180 degrees. If the requested data is not available, the closest
- *   value will be used(it should probably be NA instead).
+ *   360-by-180 degrees, and may have any layout. Its missing cells (see
+ *   NoData) are left out of the interpolation.
  * @param lat1,lat2 Minimum and maximum latitude present in the src.
  * @param lng1,lng2 Minimum and maximum longitude present in the src.
- * @param tgt The target of the projection.
+ * @param tgt The target of the projection. Cells that fall outside of src,
+ *   and cells whose source cells are all missing, are set to its
+ *   NoData::na(), which raster reads back as NA whatever tgt's data type.
  * @param xOrigin,xTotal,yOrigin,yTotal If the entire 360-by-180 degree world
  *   projected is xTotal by yTotal pixels, the tgt is a square located at
  *   xOrigin and yOrigin.
+ * @param blockSize Edge length of the square blocks of tgt that are handed
+ *   out to worker threads.
  */
-template <class T>
-void project(Projection<T>* pProject, Interpolator<T>* pInterp,
-  const Grid<T>& src, double lat1, double lat2, double lng1, double lng2,
-  const Grid<T>& tgt, index_t xOrigin, index_t xTotal, index_t yOrigin, index_t yTotal) {
-
-  ProjectionWorker<T> worker(
-      pProject, pInterp, &src, lat1, lat2, lng1, lng2,
-      &tgt, xOrigin, xTotal, yOrigin, yTotal);
+template <class T, class TInterp, class TProj, class TLayout>
+void project(const TProj& proj, const TInterp& interp,
+  const Grid<T, TLayout>& src, double lat1, double lat2, double lng1, double lng2,
+  const Grid<T>& tgt, index_t xOrigin, index_t xTotal, index_t yOrigin, index_t yTotal,
+  index_t blockSize = DEFAULT_BLOCK_SIZE) {
 
-  RcppParallel::parallelFor(0, tgt.nrow() * tgt.ncol(), worker, 256);
+  std::vector<ProjectionTile<T> > tiles(1, ProjectionTile<T>(&tgt, xOrigin, yOrigin));
+  project_tiles(proj, interp, src, lat1, lat2, lng1, lng2,
+    tiles, xTotal, yTotal, blockSize);
 }
 
 #endif
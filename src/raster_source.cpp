@@ -0,0 +1,51 @@
+#include <Rcpp.h>
+
+#include "raster_source.hpp"
+
+using namespace Rcpp;
+
+// Opens a source raster for rendering from repeatedly: maps its file and
+// checks that it holds a raster of the given layout, with cells in byteOrder
+// ("little" or "big"). The file is a tiled copy of the raster (see
+// retile_file) if tiled is set. Returns an external pointer, which releases
+// the mapping when it's garbage collected.
+// [[Rcpp::export]]
+SEXP openRasterSource(const std::string& from, bool tiled,
+    int fromStride, int fromRows, int fromCols,
+    int bands, const std::string& bandOrder, const std::string& dataFormat,
+    const std::string& byteOrder) {
+  if (fromRows <= 0 || fromCols <= 0 || fromStride < fromCols) {
+    stop("Invalid raster dimensions");
+  }
+  if (bands <= 0) {
+    stop("bands must be positive");
+  }
+  BandOrder order;
+  if (!parseBandOrder(bandOrder, &order)) {
+    stop("Unknown band order: %s", bandOrder);
+  }
+  if (dataFormatSize(dataFormat) == 0) {
+    stop("Unknown data format: %s", dataFormat);
+  }
+  bool swap;
+  if (!parseByteOrder(byteOrder, &swap)) {
+    stop("Unknown byte order: %s", byteOrder);
+  }
+  if (dataFormat == "LOG1S" && sizeof(bool) != 1) {
+    stop("The size of 'bool' on your architecture is not 1 byte. Please report this issue to the rasterfaster author.");
+  }
+
+  XPtr<RasterSource> pSource(new RasterSource(from, tiled, fromStride, fromRows,
+    fromCols, bands, order, dataFormat, swap), true);
+  if (pSource->file.end() - pSource->file.begin() < pSource->expectedBytes()) {
+    stop("File %s is too small for its raster", from);
+  }
+  return pSource;
+}
+
+// Whether source still points at an open raster (external pointers don't
+// survive serialization).
+// [[Rcpp::export]]
+bool rasterSourceIsValid(SEXP source) {
+  return TYPEOF(source) == EXTPTRSXP && R_ExternalPtrAddr(source) != NULL;
+}
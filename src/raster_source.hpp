@@ -0,0 +1,80 @@
+#ifndef RASTER_SOURCE_HPP
+#define RASTER_SOURCE_HPP
+
+#include <string>
+
+#include <Rcpp.h>
+
+#include "byteswap.hpp"
+#include "grid.hpp"
+#include "mmfile.hpp"
+#include "tile_cache.hpp"
+
+// The size in bytes of a cell of the given data format; 0 if the format is
+// unknown.
+inline size_t dataFormatSize(const std::string& dataFormat) {
+  if (dataFormat == "FLT8S") return 8;
+  if (dataFormat == "FLT4S" || dataFormat == "INT4U" || dataFormat == "INT4S") return 4;
+  if (dataFormat == "INT2U" || dataFormat == "INT2S") return 2;
+  if (dataFormat == "INT1U" || dataFormat == "INT1S" || dataFormat == "LOG1S") return 1;
+  return 0;
+}
+
+// A source raster that's opened once (see openRasterSource) and then rendered
+// from any number of times. The whole file stays mapped, and its layout is
+// checked up front, so a render only has to look it up. The file is assumed
+// not to change while it's open; reopen it if it does.
+class RasterSource {
+  // Not copyable
+  RasterSource(const RasterSource&);
+  RasterSource& operator=(const RasterSource&);
+
+public:
+  std::string path, dataFormat;
+  index_t stride, rows, cols, bands;
+  BandOrder order;
+  // Whether the file is a tiled copy (see Tiled) rather than row-major
+  bool tiled;
+  // Whether the file is in the other byte order than the host's
+  bool swapBytes;
+  // The file's identity when it was opened, for the tile cache
+  std::string identity;
+  MMFile<char> file;
+
+  RasterSource(const std::string& path, bool tiled, index_t stride,
+    index_t rows, index_t cols, index_t bands, BandOrder order,
+    const std::string& dataFormat, bool swapBytes) :
+    path(path), dataFormat(dataFormat),
+    stride(stride), rows(rows), cols(cols), bands(bands), order(order),
+    tiled(tiled), swapBytes(swapBytes),
+    identity(fileIdentity(path)),
+    // Tiles read scattered parts of the source, so the kernel isn't asked
+    // to read ahead; but huge pages make each fault bring in a large run.
+    file(path, boost::interprocess::read_only, MM_ACCESS_NORMAL, true) {
+  }
+
+  // The number of bytes the file must have to hold the raster
+  double expectedBytes() const {
+    index_t cells = tiled ? Tiled::cells(stride, rows, bands) :
+      RowMajor::cells(stride, rows, bands);
+    return static_cast<double>(cells) * dataFormatSize(dataFormat);
+  }
+};
+
+// The RasterSource behind an external pointer made by openRasterSource; NULL if
+// source is NULL.
+inline RasterSource* getRasterSource(SEXP source) {
+  if (Rf_isNull(source)) {
+    return NULL;
+  }
+  if (TYPEOF(source) != EXTPTRSXP) {
+    Rcpp::stop("Invalid raster handle");
+  }
+  Rcpp::XPtr<RasterSource> pSource(source);
+  if (!pSource.get()) {
+    Rcpp::stop("Invalid raster handle");
+  }
+  return pSource.get();
+}
+
+#endif
@@ -3,8 +3,11 @@
 // [[Rcpp::depends(RcppParallel)]]
 #include <RcppParallel.h>
 #include "mmfile.hpp"
+#include "output.hpp"
 #include "grid.hpp"
 #include "resample_algos.hpp"
+#include "resample_kernels.hpp"
+#include "simd.hpp"
 
 using namespace Rcpp;
 
@@ -12,83 +15,548 @@ using namespace Rcpp;
 //  NumericVector y   = NumericVector::create(0.0, 1.0);
 //  List z            = List::create(x, y);
 
+// Bilinear resampling driven by precomputed AxisTables; each target row is
+// filled by a (possibly vectorized) row kernel that does just the gathers and
+// the weighted sums, leaving out missing source cells.
 template <class T>
-class ResampleWorker : public RcppParallel::Worker {
+class BilinearTableWorker : public RcppParallel::Worker {
   Grid<T>* pSrc;
   Grid<T>* pTgt;
-  const Interpolator<T>* pInterp;
-  double xRatio;
-  double yRatio;
+  const AxisTable* pCols;
+  const AxisTable* pRows;
+  const GridBlocks* pBlocks;
+  typename BilinearRowKernel<T>::type kernel;
+  index_t safeCols;
+  bool swapBytes;
+  SimdLevel level;
 
 public:
-  ResampleWorker(Grid<T>* pSrc, Grid<T>* pTgt, const Interpolator<T>* pInterp) :
-  pSrc(pSrc), pTgt(pTgt), pInterp(pInterp) {
-    xRatio = static_cast<double>(pSrc->ncol()) / pTgt->ncol();
-    yRatio = static_cast<double>(pSrc->nrow()) / pTgt->nrow();
+  BilinearTableWorker(Grid<T>* pSrc, Grid<T>* pTgt,
+    const AxisTable* pCols, const AxisTable* pRows, const GridBlocks* pBlocks,
+    bool swapBytes, SimdLevel level) :
+  pSrc(pSrc), pTgt(pTgt), pCols(pCols), pRows(pRows), pBlocks(pBlocks),
+  kernel(bilinearRowKernel<T>(level)), swapBytes(swapBytes), level(level) {
+    // hi is never less than lo, so it alone limits the safe gathers.
+    safeCols = safeGatherCount<T>(&pCols->hi[0], pTgt->ncol(), pSrc->ncol());
   }
 
+  // begin and end are block numbers, not cell numbers
   void operator()(size_t begin, size_t end) {
+    render(begin, end, pTgt);
+  }
+
+  // Renders blocks begin to end into pOut, which is the target or a window
+  // onto the target's rows that covers those blocks.
+  void render(size_t begin, size_t end, Grid<T>* pOut) {
+    const axis_index_t* xlo = &pCols->lo[0];
+    const axis_index_t* xhi = &pCols->hi[0];
+    const double* wxlo = &pCols->wlo[0];
+    const double* wxhi = &pCols->whi[0];
+    double nodata = pSrc->nodata().compareValue();
+    T na = pTgt->nodata().na();
+    // A target row reads two adjacent source rows, which the next target
+    // row often reads too
+    SourceRows<T> src(pSrc, swapBytes, 2, level);
+
     for (size_t i = begin; i < end; i++) {
-      size_t x = i / pTgt->nrow();
-      size_t y = i % pTgt->nrow();
+      index_t row0, row1, col0, col1;
+      pBlocks->bounds(i, &row0, &row1, &col0, &col1);
+      index_t nsafe = safeCols > col0 ? std::min(safeCols, col1) - col0 : 0;
+      RowCells cells = swapBytes ?
+        RowCells(xlo + col0, xhi + col0, col1 - col0) : RowCells(0, 0);
 
-      *pTgt->at(y, x) = static_cast<T>(pInterp->getValue(*pSrc,
-        (x + 0.5) * xRatio - 0.5, (y + 0.5) * yRatio - 0.5));
+      for (index_t y = row0; y < row1; y++) {
+        kernel(src.row(pRows->lo[y], cells), src.row(pRows->hi[y], cells),
+          pRows->wlo[y], pRows->whi[y],
+          xlo + col0, xhi + col0, wxlo + col0, wxhi + col0, nodata, na,
+          pOut->at(y, col0), col1 - col0, nsafe);
+      }
     }
   }
 };
 
+// Nearest-neighbor resampling driven by precomputed AxisTables. Cells are
+// copied unchanged, so a source in the other byte order is copied as it is,
+// and then each run of target cells is swapped while it's still in cache.
+// Cells with the source's nodata value are then rewritten as the target's,
+// if the two differ; NaN cells are left as they are, as raster reads them as
+// NA anyway.
+template <class T>
+class NearestTableWorker : public RcppParallel::Worker {
+  Grid<T>* pSrc;
+  Grid<T>* pTgt;
+  const AxisTable* pCols;
+  const AxisTable* pRows;
+  const GridBlocks* pBlocks;
+  typename NearestRowKernel<T>::type kernel;
+  index_t safeCols;
+  // NULL if the source is in host order
+  ByteSwapKernel swapKernel;
+  bool remap;
+
+public:
+  NearestTableWorker(Grid<T>* pSrc, Grid<T>* pTgt,
+    const AxisTable* pCols, const AxisTable* pRows, const GridBlocks* pBlocks,
+    bool swapBytes, SimdLevel level) :
+  pSrc(pSrc), pTgt(pTgt), pCols(pCols), pRows(pRows), pBlocks(pBlocks),
+  kernel(nearestRowKernel<T>(level)),
+  swapKernel(swapBytes && sizeof(T) > 1 ? byteSwapKernel<T>(level) : NULL),
+  remap(pSrc->nodata().has() && pSrc->nodata().na() != pTgt->nodata().na()) {
+    safeCols = safeGatherCount<T>(&pCols->nearest[0], pTgt->ncol(), pSrc->ncol());
+  }
+
+  // begin and end are block numbers, not cell numbers
+  void operator()(size_t begin, size_t end) {
+    render(begin, end, pTgt);
+  }
+
+  // As BilinearTableWorker::render
+  void render(size_t begin, size_t end, Grid<T>* pOut) {
+    const axis_index_t* xs = &pCols->nearest[0];
+    const NoData<T>& nodata = pSrc->nodata();
+    T na = pTgt->nodata().na();
+
+    for (size_t i = begin; i < end; i++) {
+      index_t row0, row1, col0, col1;
+      pBlocks->bounds(i, &row0, &row1, &col0, &col1);
+      index_t nsafe = safeCols > col0 ? std::min(safeCols, col1) - col0 : 0;
+
+      for (index_t y = row0; y < row1; y++) {
+        T* out = pOut->at(y, col0);
+        kernel(pSrc->at(pRows->nearest[y], 0), xs + col0, out, col1 - col0, nsafe);
+        if (swapKernel) {
+          swapKernel(out, out, col1 - col0);
+        }
+        if (remap) {
+          for (index_t x = 0; x < col1 - col0; x++) {
+            out[x] = nodata.missing(out[x]) ? na : out[x];
+          }
+        }
+      }
+    }
+  }
+};
+
+// Two-pass separable filtering (area average, bicubic, Lanczos). Work is
+// handed out in bands of whole target rows. Each source row that a band needs
+// is filtered horizontally once, into a ring of scratch rows, and the
+// vertical pass then combines those rows for each target row.
+//
+// Missing source cells are left out, and the weights of the others scaled
+// back up to a total of 1; a target cell whose source cells have no weight
+// left gets the target's na. Bicubic and Lanczos kernels have negative
+// lobes, so the weight left can be close to 0 while the cells it's spread
+// over still have large values, and scaling that up overshoots without
+// bound; with them, a target cell also gets na unless its remaining source
+// cells carry at least half of the weight. Source rows are checked for missing cells as
+// they're filtered, and rows without any (usually most of them) take the
+// plain path, which gives the same values as if there were no missing cells
+// at all.
+template <class T>
+class SeparableFilterWorker : public RcppParallel::Worker {
+  Grid<T>* pSrc;
+  Grid<T>* pTgt;
+  const FilterTable* pCols;
+  const FilterTable* pRows;
+  index_t bandRows;
+  bool swapBytes;
+  SimdLevel level;
+  // The weight a target cell's source cells must have left to be scaled up
+  double minWeight;
+
+public:
+  SeparableFilterWorker(Grid<T>* pSrc, Grid<T>* pTgt,
+    const FilterTable* pCols, const FilterTable* pRows, index_t bandRows,
+    bool swapBytes, SimdLevel level) :
+  pSrc(pSrc), pTgt(pTgt), pCols(pCols), pRows(pRows), bandRows(bandRows),
+  swapBytes(swapBytes), level(level) {
+    bool negative =
+      *std::min_element(pCols->weights.begin(), pCols->weights.end()) < 0 ||
+      *std::min_element(pRows->weights.begin(), pRows->weights.end()) < 0;
+    minWeight = negative ? 0.5 : 0;
+  }
+
+  // begin and end are band numbers
+  void operator()(size_t begin, size_t end) {
+    render(begin, end, pTgt);
+  }
+
+  // Renders bands begin to end into pOut, which is the target or a window
+  // onto the target's rows that covers those bands.
+  void render(size_t begin, size_t end, Grid<T>* pOut) {
+    const index_t ncol = pTgt->ncol();
+    const index_t vtaps = pRows->taps;
+
+    // The source rows needed by one target row always fall within a run of
+    // vtaps consecutive rows, so a ring of vtaps rows indexed by source row
+    // number never evicts a row that is still needed.
+    std::vector<double> ring(vtaps * ncol);
+    std::vector<index_t> ringTags(vtaps, std::numeric_limits<index_t>::max());
+    // Whether each ring row has missing cells, and if so, the weight of each
+    // filtered cell's source cells that aren't missing, and whether that's
+    // all of them
+    std::vector<char> ringMissing(vtaps);
+    std::vector<double> ringWeights(vtaps * ncol);
+    std::vector<char> ringComplete(vtaps * ncol);
+    std::vector<double> acc(ncol), accWeights(ncol);
+    std::vector<char> accComplete(ncol);
+    // Each source row is only read once per band, by the horizontal pass
+    SourceRows<T> rows(pSrc, swapBytes, 1, level);
+    RowCells cells(0, pSrc->ncol());
+    const NoData<T>& nodata = pSrc->nodata();
+    T na = pTgt->nodata().na();
+
+    for (size_t band = begin; band < end; band++) {
+      index_t y0 = band * bandRows;
+      index_t y1 = std::min(y0 + bandRows, pTgt->nrow());
+
+      for (index_t y = y0; y < y1; y++) {
+        // Whether none of the source rows that count have missing cells
+        bool complete = true;
+
+        for (index_t k = 0; k < vtaps; k++) {
+          index_t srcRow = pRows->idx[y * vtaps + k];
+          index_t slot = srcRow % vtaps;
+
+          if (ringTags[slot] != srcRow) {
+            // Horizontal pass for this source row
+            const T* src = rows.row(srcRow, cells);
+            ringMissing[slot] = nodata.possible() && nodata.any(src, pSrc->ncol());
+            filterRow(src, ringMissing[slot], &ring[slot * ncol],
+              &ringWeights[slot * ncol], &ringComplete[slot * ncol]);
+            ringTags[slot] = srcRow;
+          }
+          complete = complete && (pRows->weights[y * vtaps + k] == 0 || !ringMissing[slot]);
+        }
+
+        std::fill(acc.begin(), acc.end(), 0.0);
+        if (!complete) {
+          std::fill(accWeights.begin(), accWeights.end(), 0.0);
+          std::fill(accComplete.begin(), accComplete.end(), 1);
+        }
+        for (index_t k = 0; k < vtaps; k++) {
+          index_t slot = pRows->idx[y * vtaps + k] % vtaps;
+          double vw = pRows->weights[y * vtaps + k];
+          const double* filtered = &ring[slot * ncol];
+
+          if (vw == 0)
+            continue;
+          for (index_t x = 0; x < ncol; x++) {
+            acc[x] += vw * filtered[x];
+          }
+          if (complete) {
+            continue;
+          }
+          if (ringMissing[slot]) {
+            const double* weights = &ringWeights[slot * ncol];
+            const char* rowComplete = &ringComplete[slot * ncol];
+            for (index_t x = 0; x < ncol; x++) {
+              accWeights[x] += vw * weights[x];
+              accComplete[x] &= rowComplete[x];
+            }
+          } else {
+            for (index_t x = 0; x < ncol; x++) {
+              accWeights[x] += vw;
+            }
+          }
+        }
+
+        T* out = pOut->at(y, 0);
+        if (complete) {
+          for (index_t x = 0; x < ncol; x++) {
+            out[x] = saturate_cast<T>(acc[x]);
+          }
+        } else {
+          for (index_t x = 0; x < ncol; x++) {
+            out[x] = accComplete[x] ? saturate_cast<T>(acc[x]) :
+              (accWeights[x] > minWeight ? saturate_cast<T>(acc[x] / accWeights[x]) : na);
+          }
+        }
+      }
+    }
+  }
+
+private:
+  // Filters the source row src horizontally into filtered. If the row has
+  // missing cells, they're left out, and the weight of the source cells that
+  // aren't and whether that's all of them go into weights and complete.
+  void filterRow(const T* src, bool missing, double* filtered, double* weights,
+    char* complete) const {
+
+    const index_t ncol = pTgt->ncol(), htaps = pCols->taps;
+    const axis_index_t* hidx = &pCols->idx[0];
+    const double* hw = &pCols->weights[0];
+    const NoData<T>& nodata = pSrc->nodata();
+
+    if (!missing) {
+      for (index_t x = 0; x < ncol; x++) {
+        const axis_index_t* xi = hidx + x * htaps;
+        const double* xw = hw + x * htaps;
+        double sum = 0;
+        for (index_t t = 0; t < htaps; t++) {
+          sum += xw[t] * static_cast<double>(src[xi[t]]);
+        }
+        filtered[x] = sum;
+      }
+      return;
+    }
+
+    for (index_t x = 0; x < ncol; x++) {
+      const axis_index_t* xi = hidx + x * htaps;
+      const double* xw = hw + x * htaps;
+      double sum = 0;
+      double total = 0;
+      bool all = true;
+      for (index_t t = 0; t < htaps; t++) {
+        T value = src[xi[t]];
+        bool ok = !nodata.missing(value);
+        sum += ok ? xw[t] * static_cast<double>(value) : 0;
+        total += ok ? xw[t] : 0;
+        all = all && ok;
+      }
+      filtered[x] = sum;
+      weights[x] = total;
+      complete[x] = all;
+    }
+  }
+};
+
+// Renders the resampled source from_g into target. Both are single-band
+// grids, into which the bands have been folded as resample_files describes.
+// from_g is in the other byte order than the host's if swapBytes is set.
+// Target cells with no source data are set to the target grid's
+// NoData::na().
+template<class T>
+void resample_grid(const std::string& method, FilterType filter, bool isFilter,
+  Grid<T>* from_g, bool swapBytes, OutputTarget<T>* target,
+  index_t fromRows, index_t fromCols, index_t toRows, index_t toCols,
+  index_t bands, bool foldRows, bool interleaved, index_t blockSize) {
+
+  index_t foldedToRows = target->grid()->nrow();
+  index_t foldedToCols = target->grid()->ncol();
+
+  if (isFilter) {
+    FilterTable cols(filter, fromCols, toCols);
+    FilterTable rows(filter, fromRows, toRows);
+    (foldRows ? rows : cols).foldBands(bands,
+      foldRows ? fromRows : fromCols, interleaved);
+    SeparableFilterWorker<T> worker(from_g, target->grid(), &cols, &rows, blockSize,
+      swapBytes, simdLevel());
+    target->render(&worker, blockSize, 1, (foldedToRows + blockSize - 1) / blockSize);
+    return;
+  }
+
+  GridBlocks blocks(foldedToRows, foldedToCols, blockSize);
+
+  // Bilinear and nearest neighbor are separable too, so use per-row and
+  // per-column lookup tables instead of computing source coordinates for
+  // every pixel.
+  AxisTable cols(fromCols, toCols);
+  AxisTable rows(fromRows, toRows);
+  (foldRows ? rows : cols).foldBands(bands,
+    foldRows ? fromRows : fromCols, interleaved);
+  if (method == "bilinear") {
+    BilinearTableWorker<T> worker(from_g, target->grid(), &cols, &rows, &blocks,
+      swapBytes, simdLevel());
+    target->render(&worker, blockSize, blocks.across(), blocks.size());
+  } else {
+    NearestTableWorker<T> worker(from_g, target->grid(), &cols, &rows, &blocks,
+      swapBytes, simdLevel());
+    target->render(&worker, blockSize, blocks.across(), blocks.size());
+  }
+}
+
+// Resamples the file from, which is in the other byte order than the host's
+// if swapBytes is set, into the file to; the target is always in host order.
+// fromNA and toNA are the nodata values of their headers. If values isn't
+// NULL, the target is rendered into memory instead, and then copied into
+// values (see copy_values), with toNA as its nodata value; to and output are
+// unused.
 template<class T>
 void resample_files(const std::string& method,
-  const std::string& from, index_t fromStride, index_t fromRows, index_t fromCols,
-  const std::string& to, index_t toStride, index_t toRows, index_t toCols) {
+  const std::string& from, bool swapBytes,
+  index_t fromStride, index_t fromRows, index_t fromCols, double fromNA,
+  const std::string& to, index_t toStride, index_t toRows, index_t toCols,
+  double toNA, index_t bands, BandOrder order, index_t blockSize,
+  OutputBackend output, double* values) {
 
-  boost::shared_ptr<Interpolator<T> > interp = getInterpolator<T>(method);
-  if (!interp) {
+  FilterType filter = FILTER_AREA;
+  bool isFilter = true;
+  if (method == "average") {
+    filter = FILTER_AREA;
+  } else if (method == "bicubic") {
+    filter = FILTER_BICUBIC;
+  } else if (method == "lanczos") {
+    filter = FILTER_LANCZOS3;
+  } else if (method == "bilinear" || method == "ngb") {
+    isFilter = false;
+  } else {
     Rcpp::stop("Unknown resampling method %s", method);
   }
 
-  // Memory mapped files
-  MMFile<T> from_f(from, boost::interprocess::read_only);
-  MMFile<T> to_f(to, boost::interprocess::read_write);
+  // Memory mapped source; the target is only mapped for OUTPUT_MMAP. The
+  // filters read every source row in order. Bilinear and nearest neighbor
+  // skip rows when downsampling, where reading far ahead would be wasted.
+  MMFile<T> from_f(from, boost::interprocess::read_only,
+    isFilter ? MM_ACCESS_SEQUENTIAL : MM_ACCESS_NORMAL, true);
+
+  // The bands are folded into the rows (BSQ) or the columns (BIL and BIP)
+  // of a single-band grid; see fold_band. The target has the same band order
+  // as the source.
+  bool foldRows = order == BAND_BSQ;
+  bool interleaved = order == BAND_BIP;
+  index_t foldedFromRows = foldRows ? fromRows * bands : fromRows;
+  index_t foldedFromCols = foldRows ? fromCols : fromCols * bands;
+  index_t foldedToRows = foldRows ? toRows * bands : toRows;
+  index_t foldedToCols = foldRows ? toCols : toCols * bands;
+  index_t foldedFromStride = foldRows ? fromStride : fromStride * bands;
+  index_t foldedToStride = foldRows ? toStride : toStride * bands;
 
   // Grid will help us conveniently offset into mmap by row/col
-  Grid<T> from_g(from_f.begin(), from_f.end(), fromStride, fromRows, fromCols);
-  Grid<T> to_g(to_f.begin(), to_f.end(), toStride, toRows, toCols);
+  Grid<T> from_g(from_f.begin(), from_f.end(), foldedFromStride, foldedFromRows, foldedFromCols);
+  from_g.setNodata(NoData<T>(fromNA));
+
+  if (!values) {
+    OutputTarget<T> target(to, output, foldedToStride, foldedToRows, foldedToCols);
+    target.grid()->setNodata(NoData<T>(toNA));
+    resample_grid(method, filter, isFilter, &from_g, swapBytes, &target,
+      fromRows, fromCols, toRows, toCols, bands, foldRows, interleaved, blockSize);
+    return;
+  }
+
+  // A byte buffer rather than a std::vector<T>, which doesn't work for bool
+  std::vector<char> buffer(toRows * toStride * bands * sizeof(T));
+  T* data = reinterpret_cast<T*>(&buffer[0]);
+  OutputTarget<T> target(data, foldedToStride, foldedToRows, foldedToCols);
+  target.grid()->setNodata(NoData<T>(toNA));
+  resample_grid(method, filter, isFilter, &from_g, swapBytes, &target,
+    fromRows, fromCols, toRows, toCols, bands, foldRows, interleaved, blockSize);
 
-  ResampleWorker<T> worker(&from_g, &to_g, interp.get());
-  RcppParallel::parallelFor(0, toRows * toCols, worker);
+  Grid<T> rendered(data, data + toRows * toStride * bands, toStride, toRows, toCols,
+    bands, order);
+  copy_values(rendered, toNA, values);
 }
 
-// [[Rcpp::export]]
-void resample_files_numeric(
+// Resamples every band of a file with the given number of bands, laid out in
+// bandOrder, into a file with the same layout, or into values; see
+// resample_files.
+void resample_numeric(
     const std::string& from, int fromStride, int fromRows, int fromCols,
+    double fromNA,
     const std::string& to, int toStride, int toRows, int toCols,
-    const std::string& dataFormat,
-    const std::string& method) {
+    double toNA,
+    int bands, const std::string& bandOrder,
+    const std::string& dataFormat, const std::string& byteOrder,
+    const std::string& method,
+    int blockSize, OutputBackend backend, double* values) {
+
+  if (blockSize <= 0) {
+    Rcpp::stop("blockSize must be positive");
+  }
+  if (bands <= 0) {
+    Rcpp::stop("bands must be positive");
+  }
+  BandOrder order;
+  if (!parseBandOrder(bandOrder, &order)) {
+    Rcpp::stop("Unknown band order: %s", bandOrder);
+  }
+  bool swap;
+  if (!parseByteOrder(byteOrder, &swap)) {
+    Rcpp::stop("Unknown byte order: %s", byteOrder);
+  }
 
   if (dataFormat == "FLT8S") {
-    resample_files<double>(method, from, fromStride, fromRows, fromCols, to, toStride, toRows, toCols);
+    resample_files<double>(method, from, swap, fromStride, fromRows, fromCols, fromNA, to, toStride, toRows, toCols, toNA, bands, order, blockSize, backend, values);
   } else if (dataFormat == "FLT4S") {
-    resample_files<float>(method, from, fromStride, fromRows, fromCols, to, toStride, toRows, toCols);
+    resample_files<float>(method, from, swap, fromStride, fromRows, fromCols, fromNA, to, toStride, toRows, toCols, toNA, bands, order, blockSize, backend, values);
   } else if (dataFormat == "INT4U") {
-    resample_files<uint32_t>(method, from, fromStride, fromRows, fromCols, to, toStride, toRows, toCols);
+    resample_files<uint32_t>(method, from, swap, fromStride, fromRows, fromCols, fromNA, to, toStride, toRows, toCols, toNA, bands, order, blockSize, backend, values);
   } else if (dataFormat == "INT4S") {
-    resample_files<int32_t>(method, from, fromStride, fromRows, fromCols, to, toStride, toRows, toCols);
+    resample_files<int32_t>(method, from, swap, fromStride, fromRows, fromCols, fromNA, to, toStride, toRows, toCols, toNA, bands, order, blockSize, backend, values);
   } else if (dataFormat == "INT2U") {
-    resample_files<uint16_t>(method, from, fromStride, fromRows, fromCols, to, toStride, toRows, toCols);
+    resample_files<uint16_t>(method, from, swap, fromStride, fromRows, fromCols, fromNA, to, toStride, toRows, toCols, toNA, bands, order, blockSize, backend, values);
   } else if (dataFormat == "INT2S") {
-    resample_files<int16_t>(method, from, fromStride, fromRows, fromCols, to, toStride, toRows, toCols);
+    resample_files<int16_t>(method, from, swap, fromStride, fromRows, fromCols, fromNA, to, toStride, toRows, toCols, toNA, bands, order, blockSize, backend, values);
   } else if (dataFormat == "INT1U") {
-    resample_files<uint8_t>(method, from, fromStride, fromRows, fromCols, to, toStride, toRows, toCols);
+    resample_files<uint8_t>(method, from, swap, fromStride, fromRows, fromCols, fromNA, to, toStride, toRows, toCols, toNA, bands, order, blockSize, backend, values);
   } else if (dataFormat == "INT1S") {
-    resample_files<int8_t>(method, from, fromStride, fromRows, fromCols, to, toStride, toRows, toCols);
+    resample_files<int8_t>(method, from, swap, fromStride, fromRows, fromCols, fromNA, to, toStride, toRows, toCols, toNA, bands, order, blockSize, backend, values);
   } else if (dataFormat == "LOG1S") {
     if (sizeof(bool) != 1) {
       Rcpp::stop("The size of 'bool' on your architecture is not 1 byte. Please report this issue to the rasterfaster author.");
     }
-    resample_files<bool>(method, from, fromStride, fromRows, fromCols, to, toStride, toRows, toCols);
+    resample_files<bool>(method, from, swap, fromStride, fromRows, fromCols, fromNA, to, toStride, toRows, toCols, toNA, bands, order, blockSize, backend, values);
   } else {
     Rcpp::stop("Unknown data format: %s", dataFormat);
   }
 }
+
+// Resamples every band of a file with the given number of bands, laid out in
+// bandOrder ("BIL", "BIP" or "BSQ"), into a file with the same layout,
+// which is written with the given output backend ("mmap", "write" or
+// "write-behind"; see OutputBackend). The source's cells are in byteOrder
+// ("little" or "big"); the target's are in the host's byte order. fromNA and
+// toNA are the nodata values of the two files: source cells with fromNA are
+// left out of the target's values, and target cells without any source data
+// get toNA.
+// [[Rcpp::export]]
+void resample_files_numeric(
+    const std::string& from, int fromStride, int fromRows, int fromCols,
+    double fromNA,
+    const std::string& to, int toStride, int toRows, int toCols,
+    double toNA,
+    int bands, const std::string& bandOrder,
+    const std::string& dataFormat, const std::string& byteOrder,
+    const std::string& method,
+    int blockSize, const std::string& output) {
+
+  OutputBackend backend;
+  if (!parseOutputBackend(output, &backend)) {
+    Rcpp::stop("Unknown output backend: %s", output);
+  }
+  resample_numeric(from, fromStride, fromRows, fromCols, fromNA,
+    to, toStride, toRows, toCols, toNA,
+    bands, bandOrder, dataFormat, byteOrder, method, blockSize, backend, NULL);
+}
+
+// Like resample_files_numeric, but returns the resampled values instead of
+// writing them to a file, in the order of a Raster object's values: band by
+// band, and row by row within each band. Cells with the nodata value, and
+// cells without any source data, become NA.
+// [[Rcpp::export]]
+NumericVector resample_values_numeric(
+    const std::string& from, int fromStride, int fromRows, int fromCols,
+    int toRows, int toCols,
+    int bands, const std::string& bandOrder,
+    const std::string& dataFormat, const std::string& byteOrder,
+    const std::string& method,
+    int blockSize, double nodata) {
+
+  if (toRows <= 0 || toCols <= 0 || bands <= 0) {
+    Rcpp::stop("The target must have at least one cell");
+  }
+  NumericVector values(static_cast<R_xlen_t>(toRows) * toCols * bands);
+  resample_numeric(from, fromStride, fromRows, fromCols, nodata,
+    std::string(), toCols, toRows, toCols, nodata,
+    bands, bandOrder, dataFormat, byteOrder, method, blockSize, OUTPUT_MEMORY,
+    values.begin());
+  return values;
+}
+
+// Reports the instruction set used by the resampling kernels, after setting
+// it to `level` if one is given. Mostly useful for benchmarking and for
+// comparing the vectorized kernels against the scalar ones.
+// [[Rcpp::export]]
+std::string simd_level(const std::string& level) {
+  if (!level.empty()) {
+    SimdLevel requested;
+    if (!parseSimdLevel(level, &requested)) {
+      Rcpp::stop("Unknown SIMD level: %s", level);
+    }
+    if (requested > detectSimdLevel()) {
+      Rcpp::stop("SIMD level %s is not supported on this CPU", level);
+    }
+    simdLevel() = requested;
+  }
+  return simdLevelName(simdLevel());
+}
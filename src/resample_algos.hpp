@@ -2,28 +2,57 @@
 #define RESAMPLE_ALGOS_HPP
 
 #include <algorithm>
+#include <cmath>
 #include <iostream>
+#include <limits>
+#include <vector>
 
-#include <boost/shared_ptr.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/scoped_array.hpp>
 
+#include "byteswap.hpp"
 #include "grid.hpp"
 
-template <class T>
-class Interpolator {
-public:
-  virtual ~Interpolator() {}
-  virtual T getValue(const Grid<T>& src, double x, double y) const = 0;
-
-};
+// Interpolators are policy classes: workers are instantiated for a specific
+// interpolator type so that getValues() can be inlined into the per-pixel
+// loop. Every interpolator provides
+//
+//   template <class TLayout>
+//   void getValues(const Grid<T, TLayout>& src, double x, double y,
+//     T* out, index_t outStep, T na) const;
+//
+// where x and y are (fractional) source column and row, and src may have
+// any layout. It interpolates
+// every band of src at that point, working out the source cells and their
+// weights once, and writes band b's value to out[b * outStep]. Missing source
+// cells (see Grid::nodata) are left out; a band with nothing but missing
+// cells to interpolate gets na.
+//
+// An interpolator made with swapBytes reads a source stored in the other
+// byte order than the host's, swapping each cell as it's fetched; the
+// results are in host order.
 
 template<class T>
-class NearestNeighbor : public Interpolator<T> {
+class NearestNeighbor {
+  bool swapBytes;
+
 public:
-  T getValue(const Grid<T>& src, double x, double y) const {
-    return *src.at(
+  explicit NearestNeighbor(bool swapBytes = false) : swapBytes(swapBytes) {
+  }
+
+  template <class TLayout>
+  void getValues(const Grid<T, TLayout>& src, double x, double y,
+    T* out, index_t outStep, T na) const {
+
+    const T* cell = src.at(
         static_cast<index_t>(round(y)),
         static_cast<index_t>(round(x))
     );
+    for (index_t b = 0; b < src.nband(); b++) {
+      T value = cell[b * src.bandStep()];
+      value = swapBytes ? swap_bytes(value) : value;
+      out[b * outStep] = src.nodata().missing(value) ? na : value;
+    }
   }
 };
 
@@ -39,38 +68,374 @@ static inline double linear_interp(double pos,
   return valueB * (pos - posA)/dist + valueA * (posB - pos)/dist;
 }
 
+// The weight of posA (the other's is 1 minus it) in linear_interp
+static inline double linear_weight(double pos, double posA, double posB) {
+  return posB == posA ? 1 : (posB - pos) / (posB - posA);
+}
+
 template<class T>
-class Bilinear : public Interpolator<T> {
+class Bilinear {
+  bool swapBytes;
+
+  T load(const T* cell) const {
+    return swapBytes ? swap_bytes(*cell) : *cell;
+  }
+
 public:
-  T getValue(const Grid<T>& src, double x, double y) const {
+  explicit Bilinear(bool swapBytes = false) : swapBytes(swapBytes) {
+  }
+
+  template <class TLayout>
+  void getValues(const Grid<T, TLayout>& src, double x, double y,
+    T* out, index_t outStep, T na) const {
+
     index_t x1 = std::floor(x), x2 = std::ceil(x);
     index_t y1 = std::floor(y), y2 = std::ceil(y);
 
-    // Get the values at the four pixels surrounding x/y.
-    double nw = *src.at(y1, x1);
-    double ne = *src.at(y1, x2);
-    double sw = *src.at(y2, x1);
-    double se = *src.at(y2, x2);
+    // The four pixels surrounding x/y.
+    const T* nw = src.at(y1, x1);
+    const T* ne = src.at(y1, x2);
+    const T* sw = src.at(y2, x1);
+    const T* se = src.at(y2, x2);
+    const NoData<T>& nodata = src.nodata();
+
+    for (index_t b = 0; b < src.nband(); b++) {
+      index_t i = b * src.bandStep();
+      T vnw = load(nw + i), vne = load(ne + i), vsw = load(sw + i), vse = load(se + i);
+      bool okNW = !nodata.missing(vnw), okNE = !nodata.missing(vne);
+      bool okSW = !nodata.missing(vsw), okSE = !nodata.missing(vse);
+
+      if (okNW && okNE && okSW && okSE) {
+        // Combine the two northern points using linear interpolation.
+        double n = linear_interp(x, x1, x2, vnw, vne);
+        // Combine the two southern points using linear interpolation.
+        double s = linear_interp(x, x1, x2, vsw, vse);
+        // Combine the calculated north and south values.
+        // TODO: Should this be rounding instead of casting?
+        out[b * outStep] = static_cast<T>(linear_interp(y, y1, y2, n, s));
+        continue;
+      }
 
-    // Combine the two northern points using linear interpolation.
-    double n = linear_interp(x, x1, x2, nw, ne);
-    // Combine the two southern points using linear interpolation.
-    double s = linear_interp(x, x1, x2, sw, se);
-    // Combine the calculated north and south values.
-    // TODO: Should this be rounding instead of casting?
-    return static_cast<T>(linear_interp(y, y1, y2, n, s));
+      // Some are missing: weigh the others as above, and scale their
+      // weights back up to a total of 1
+      double wx = linear_weight(x, x1, x2), wy = linear_weight(y, y1, y2);
+      double wnw = okNW ? wx * wy : 0, wne = okNE ? (1 - wx) * wy : 0;
+      double wsw = okSW ? wx * (1 - wy) : 0, wse = okSE ? (1 - wx) * (1 - wy) : 0;
+      double total = wnw + wne + wsw + wse;
+      double sum = (okNW ? wnw * static_cast<double>(vnw) : 0) +
+        (okNE ? wne * static_cast<double>(vne) : 0) +
+        (okSW ? wsw * static_cast<double>(vsw) : 0) +
+        (okSE ? wse * static_cast<double>(vse) : 0);
+      out[b * outStep] = total > 0 ? static_cast<T>(sum / total) : na;
+    }
   }
 };
 
-template <class T>
-boost::shared_ptr<Interpolator<T> > getInterpolator(const std::string& name) {
-  if (name == "ngb") {
-    return boost::shared_ptr<Interpolator<T> >(new NearestNeighbor<T>());
-  } else if (name == "bilinear") {
-    return boost::shared_ptr<Interpolator<T> >(new Bilinear<T>());
+// Maps target index i along one axis (row or column) to the source coordinate
+// sampled by resampleBy/resampleTo, so that pixel centers line up.
+static inline double resample_coord(index_t i, double ratio) {
+  return (i + 0.5) * ratio - 0.5;
+}
+
+// The type of a row or column index within one axis. A single axis never has
+// more than 2^31 cells, and 32-bit indices are what vectorized gathers take.
+typedef int32_t axis_index_t;
+
+// Resampling treats a multi-band file as a single-band grid, with the bands
+// folded into one axis: BIL and BIP rows hold every band's cells (band by
+// band, or pixel by pixel), and BSQ's bands are stacked as extra rows. The
+// tables of the folded axis then list each band's entries where they lie in
+// the file, with source indices offset to the same band and the weights
+// repeated; so positions and weights are still worked out once per target
+// cell, and the row kernels and filters work on any band order unchanged.
+
+// The position of index i of band b in a folded axis of len cells per band
+static inline index_t fold_band(index_t i, index_t b, index_t len,
+  index_t bands, bool interleaved) {
+  return interleaved ? i * bands + b : b * len + i;
+}
+
+// Folds a table with width entries per target index for bands. If srcLen
+// is not 0, the entries are source indices along an axis of that length.
+template <class TValue>
+void fold_bands(std::vector<TValue>* entries, index_t width, index_t bands,
+  bool interleaved, index_t srcLen) {
+
+  index_t tgtLen = entries->size() / width;
+  std::vector<TValue> folded(entries->size() * bands);
+  for (index_t b = 0; b < bands; b++) {
+    for (index_t i = 0; i < tgtLen; i++) {
+      const TValue* from = &(*entries)[i * width];
+      TValue* to = &folded[fold_band(i, b, tgtLen, bands, interleaved) * width];
+      for (index_t t = 0; t < width; t++) {
+        to[t] = srcLen == 0 ? from[t] : static_cast<TValue>(
+          fold_band(static_cast<index_t>(from[t]), b, srcLen, bands, interleaved));
+      }
+    }
+  }
+  entries->swap(folded);
+}
+
+// For a plain (unprojected) resample, the source column depends only on the
+// target column and the source row only on the target row. AxisTable holds,
+// for each target index along one axis, everything the interpolators would
+// otherwise recompute per pixel: the nearest source index, the two source
+// indices that straddle the sample point, and their linear weights. Indices
+// are clamped to [0, srcLen-1] the same way Grid::at clamps them.
+class AxisTable {
+public:
+  std::vector<axis_index_t> nearest;
+  std::vector<axis_index_t> lo, hi;
+  std::vector<double> wlo, whi;
+
+  AxisTable(index_t srcLen, index_t tgtLen) :
+    nearest(tgtLen), lo(tgtLen), hi(tgtLen), wlo(tgtLen), whi(tgtLen) {
+
+    double ratio = static_cast<double>(srcLen) / tgtLen;
+    for (index_t i = 0; i < tgtLen; i++) {
+      double pos = resample_coord(i, ratio);
+      double posA = std::floor(pos), posB = std::ceil(pos);
+
+      nearest[i] = clamp(round(pos), srcLen);
+      lo[i] = clamp(posA, srcLen);
+      hi[i] = clamp(posB, srcLen);
+      // Same arithmetic as linear_interp, so results match Bilinear.
+      if (posB == posA) {
+        wlo[i] = 1;
+        whi[i] = 0;
+      } else {
+        wlo[i] = (posB - pos) / (posB - posA);
+        whi[i] = (pos - posA) / (posB - posA);
+      }
+    }
+  }
+
+  // Folds the bands of a multi-band file into this axis, which has srcLen
+  // source cells per band (see fold_band)
+  void foldBands(index_t bands, index_t srcLen, bool interleaved) {
+    fold_bands(&nearest, 1, bands, interleaved, srcLen);
+    fold_bands(&lo, 1, bands, interleaved, srcLen);
+    fold_bands(&hi, 1, bands, interleaved, srcLen);
+    fold_bands(&wlo, 1, bands, interleaved, 0);
+    fold_bands(&whi, 1, bands, interleaved, 0);
+  }
+
+private:
+  static axis_index_t clamp(double pos, index_t len) {
+    if (pos <= 0)
+      return 0;
+    return static_cast<axis_index_t>(std::min(static_cast<index_t>(pos), len - 1));
+  }
+};
+
+// Resampling filters that, unlike the interpolators, widen their support when
+// downsampling so that every source cell under a target cell contributes.
+enum FilterType {
+  FILTER_AREA,     // Area-weighted average of the covered source cells
+  FILTER_BICUBIC,  // Keys cubic convolution (a = -0.5)
+  FILTER_LANCZOS3  // Lanczos windowed sinc, 3 lobes
+};
+
+static inline double sinc(double x) {
+  if (x == 0)
+    return 1;
+  x *= PI;
+  return std::sin(x) / x;
+}
+
+static inline double filter_kernel(FilterType type, double x) {
+  x = std::fabs(x);
+  if (type == FILTER_BICUBIC) {
+    const double a = -0.5;
+    if (x < 1)
+      return ((a + 2) * x - (a + 3)) * x * x + 1;
+    if (x < 2)
+      return ((a * x - 5 * a) * x + 8 * a) * x - 4 * a;
+    return 0;
   } else {
-    return boost::shared_ptr<Interpolator<T> >();
+    if (x < 3)
+      return sinc(x) * sinc(x / 3);
+    return 0;
+  }
+}
+
+// FilterTable is the AxisTable of the separable filters: for each target index
+// along one axis, the source indices (clamped like Grid::at) and normalized
+// weights of its taps. Every target index has the same number of taps, so
+// tap t of target index i is at [i * taps + t].
+class FilterTable {
+public:
+  index_t taps;
+  std::vector<axis_index_t> idx;
+  std::vector<double> weights;
+
+  FilterTable(FilterType type, index_t srcLen, index_t tgtLen) {
+    double ratio = static_cast<double>(srcLen) / tgtLen;
+    // When downsampling, stretch the kernel to cover the whole footprint of
+    // the target cell.
+    double scale = std::max(1.0, ratio);
+    double support = type == FILTER_AREA ? ratio / 2 :
+      (type == FILTER_BICUBIC ? 2 : 3) * scale;
+
+    taps = static_cast<index_t>(std::ceil(2 * support)) + 1;
+    idx.resize(tgtLen * taps);
+    weights.resize(tgtLen * taps);
+
+    for (index_t i = 0; i < tgtLen; i++) {
+      double center = resample_coord(i, ratio);
+      double first = std::floor(center - support);
+      if (type == FILTER_AREA) {
+        // Source cell j covers [j-0.5, j+0.5) in these coordinates
+        first = std::floor(center - support + 0.5);
+      }
+
+      double total = 0;
+      for (index_t t = 0; t < taps; t++) {
+        double j = first + t;
+        double w;
+        if (type == FILTER_AREA) {
+          double a = center - support, b = center + support;
+          w = std::max(0.0, std::min(j + 0.5, b) - std::max(j - 0.5, a));
+        } else {
+          w = filter_kernel(type, (j - center) / scale);
+        }
+        idx[i * taps + t] = clamp(j, srcLen);
+        weights[i * taps + t] = w;
+        total += w;
+      }
+      for (index_t t = 0; t < taps; t++) {
+        weights[i * taps + t] /= total;
+      }
+    }
+  }
+
+  // Folds the bands of a multi-band file into this axis, which has srcLen
+  // source cells per band (see fold_band)
+  void foldBands(index_t bands, index_t srcLen, bool interleaved) {
+    fold_bands(&idx, taps, bands, interleaved, srcLen);
+    fold_bands(&weights, taps, bands, interleaved, 0);
+  }
+
+private:
+  static axis_index_t clamp(double pos, index_t len) {
+    if (pos <= 0)
+      return 0;
+    return static_cast<axis_index_t>(std::min(static_cast<index_t>(pos), len - 1));
+  }
+};
+
+// The cells of a source row that a run of target cells reads: either every
+// cell in [col0, col1), or just the ones listed in idx[0] and idx[1] (n
+// entries each), which also lie within [col0, col1).
+struct RowCells {
+  const axis_index_t* idx[2];
+  index_t nidx, n;
+  index_t col0, col1;
+
+  RowCells(index_t col0, index_t col1) : nidx(0), n(0), col0(col0), col1(col1) {
+  }
+
+  RowCells(const axis_index_t* a, const axis_index_t* b, index_t n) :
+    nidx(b ? 2 : 1), n(n), col0(0), col1(0) {
+    idx[0] = a;
+    idx[1] = b;
+    if (n == 0)
+      return;
+    col0 = col1 = a[0];
+    for (index_t k = 0; k < nidx; k++) {
+      for (index_t i = 0; i < n; i++) {
+        col0 = std::min<index_t>(col0, idx[k][i]);
+        col1 = std::max<index_t>(col1, idx[k][i]);
+      }
+    }
+    col1++;
+  }
+
+  // Whether the listed cells are so far apart that swapping them one by
+  // one beats swapping the run they span (e.g. when downsampling a lot).
+  bool sparse() const {
+    return nidx > 0 && col1 - col0 > 8 * nidx * n;
+  }
+};
+
+// Source rows as a worker reads them. A source in the host's byte order is
+// read in place. A source in the other byte order has the cells that the
+// worker is about to read swapped into scratch rows first, a run at a time
+// with a vectorized kernel, so that the row kernels only ever see cells in
+// host order and the source is swapped in pieces that stay in cache. Each
+// worker call makes its own, with scratch for `slots` rows: row r goes into
+// slot r % slots, and stays there until another row needs the slot.
+template <class T>
+class SourceRows {
+  const Grid<T>* pSrc;
+  ByteSwapKernel kernel;
+  index_t slots;
+  // Left uninitialized, as workers are often handed a single block, and only
+  // the cells that are swapped into it are read
+  boost::scoped_array<char> scratch;
+  std::vector<index_t> tags, tagCol0, tagCol1;
+
+  // Rows are padded, as gathers of 8- and 16-bit cells read whole 32-bit
+  // words, and kept 8-byte aligned
+  size_t slotBytes() const {
+    return pSrc->ncol() * sizeof(T) + 8;
+  }
+
+  T* slotRow(index_t slot) {
+    return reinterpret_cast<T*>(&scratch[slot * slotBytes()]);
+  }
+
+public:
+  SourceRows(const Grid<T>* pSrc, bool swapBytes, index_t slots, SimdLevel level) :
+    pSrc(pSrc), kernel(swapBytes && sizeof(T) > 1 ? byteSwapKernel<T>(level) : NULL),
+    slots(slots) {
+    if (kernel) {
+      scratch.reset(new char[slots * slotBytes()]);
+      tags.resize(slots, std::numeric_limits<index_t>::max());
+      tagCol0.resize(slots);
+      tagCol1.resize(slots);
+    }
+  }
+
+  // The start of source row `row`, in host byte order. Only the given cells
+  // of it can be read.
+  const T* row(index_t row, const RowCells& cells) {
+    if (!kernel) {
+      return pSrc->at(row, 0);
+    }
+    index_t slot = row % slots;
+    T* out = slotRow(slot);
+    const T* src = pSrc->at(row, 0);
+    if (cells.sparse()) {
+      for (index_t k = 0; k < cells.nidx; k++) {
+        for (index_t i = 0; i < cells.n; i++) {
+          axis_index_t x = cells.idx[k][i];
+          out[x] = swap_bytes(src[x]);
+        }
+      }
+      // The slot now holds an unknown mix of cells
+      tags[slot] = std::numeric_limits<index_t>::max();
+    } else if (tags[slot] != row || cells.col0 < tagCol0[slot] ||
+      cells.col1 > tagCol1[slot]) {
+      kernel(src + cells.col0, out + cells.col0, cells.col1 - cells.col0);
+      tags[slot] = row;
+      tagCol0[slot] = cells.col0;
+      tagCol1[slot] = cells.col1;
+    }
+    return out;
+  }
+};
+
+// Converts a filtered value to T. Unlike the interpolators, bicubic and
+// Lanczos filters can overshoot the range of the source values, so integer
+// types are clamped to their range before the cast.
+template <class T>
+inline T saturate_cast(double value) {
+  if (std::numeric_limits<T>::is_integer) {
+    value = std::max(value, static_cast<double>(std::numeric_limits<T>::min()));
+    value = std::min(value, static_cast<double>(std::numeric_limits<T>::max()));
   }
+  return static_cast<T>(value);
 }
 
 #endif
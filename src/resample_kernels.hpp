@@ -0,0 +1,527 @@
+#ifndef RESAMPLE_KERNELS_HPP
+#define RESAMPLE_KERNELS_HPP
+
+#include <limits>
+
+#include <boost/cstdint.hpp>
+
+#include "grid.hpp"
+#include "resample_algos.hpp"
+#include "simd.hpp"
+
+#ifdef RASTERFASTER_X86_SIMD
+#include <immintrin.h>
+#endif
+
+// Row kernels for table-driven resampling (see AxisTable). Each call fills n
+// consecutive target cells of one row. xlo/xhi/wxlo/wxhi (or xs) are the
+// column tables, already offset to the first of those cells.
+//
+// The vectorized kernels compute bilinear values in double precision with
+// the same multiplies and adds, in the same order, as the scalar kernel, and
+// store through the same static_cast<T>. So every instruction set produces
+// output that is bit-for-bit identical to the scalar kernel. (The package is
+// built with -ffp-contract=off so the compiler can't fuse the multiplies and
+// adds into FMAs in one kernel but not another.)
+//
+// Missing source cells (see NoData) don't take part in bilinear values: each
+// target cell is the weighted sum of its neighbors that aren't missing,
+// divided by their total weight, or na if they're all missing. nodata is
+// the source's NoData::compareValue(). The vectorized kernels do this with
+// masks rather than branches: every lane computes both the plain and the
+// renormalized value, and keeps the one it needs. A target cell whose
+// neighbors are all there keeps the plain value, so it comes out exactly as
+// it would without any missing cells.
+//
+// Gathers of 8- and 16-bit cells load a full 32-bit word, which could read
+// past the end of the source mapping. Only the first nsafe cells of a row are
+// eligible for vectorized gathers; see safeGatherCount.
+
+template <class T>
+struct BilinearRowKernel {
+  typedef void (*type)(const T* north, const T* south, double wylo, double wyhi,
+    const axis_index_t* xlo, const axis_index_t* xhi,
+    const double* wxlo, const double* wxhi, double nodata, T na,
+    T* out, index_t n, index_t nsafe);
+};
+
+template <class T>
+struct NearestRowKernel {
+  typedef void (*type)(const T* src, const axis_index_t* xs,
+    T* out, index_t n, index_t nsafe);
+};
+
+// Whether a cell, widened to double, isn't missing
+static inline bool cell_present(double value, double nodata) {
+  return value == value && value != nodata;
+}
+
+template <class T>
+void bilinear_row_scalar(const T* north, const T* south, double wylo, double wyhi,
+  const axis_index_t* xlo, const axis_index_t* xhi,
+  const double* wxlo, const double* wxhi, double nodata, T na,
+  T* out, index_t n, index_t nsafe) {
+
+  for (index_t x = 0; x < n; x++) {
+    double nw = static_cast<double>(north[xlo[x]]);
+    double ne = static_cast<double>(north[xhi[x]]);
+    double sw = static_cast<double>(south[xlo[x]]);
+    double se = static_cast<double>(south[xhi[x]]);
+    bool okNW = cell_present(nw, nodata), okNE = cell_present(ne, nodata);
+    bool okSW = cell_present(sw, nodata), okSE = cell_present(se, nodata);
+    // Missing cells count as 0, with no weight
+    double wnw = okNW ? wxlo[x] : 0, wne = okNE ? wxhi[x] : 0;
+    double wsw = okSW ? wxlo[x] : 0, wse = okSE ? wxhi[x] : 0;
+    nw = okNW ? nw : 0;
+    ne = okNE ? ne : 0;
+    sw = okSW ? sw : 0;
+    se = okSE ? se : 0;
+
+    double nv = ne * wne + nw * wnw;
+    double sv = se * wse + sw * wsw;
+    double value = sv * wyhi + nv * wylo;
+    if (!(okNW && okNE && okSW && okSE)) {
+      double total = (wse + wsw) * wyhi + (wne + wnw) * wylo;
+      value = total > 0 ? value / total : static_cast<double>(na);
+    }
+    out[x] = static_cast<T>(value);
+  }
+}
+
+template <class T>
+void nearest_row_scalar(const T* src, const axis_index_t* xs,
+  T* out, index_t n, index_t nsafe) {
+
+  for (index_t x = 0; x < n; x++) {
+    out[x] = src[xs[x]];
+  }
+}
+
+// Given a column index table whose values never decrease, returns how many
+// leading entries can be gathered with 32-bit loads from a row of srcCols
+// cells of type T without reading past the end of the row.
+template <class T>
+index_t safeGatherCount(const axis_index_t* idx, index_t n, index_t srcCols) {
+  if (sizeof(T) >= 4)
+    return n;
+  index_t overhang = 4 / sizeof(T) - 1;
+  if (srcCols <= overhang)
+    return 0;
+  index_t limit = srcCols - overhang;
+  index_t count = n;
+  while (count > 0 && static_cast<index_t>(idx[count - 1]) >= limit)
+    count--;
+  return count;
+}
+
+#ifdef RASTERFASTER_X86_SIMD
+
+// --- SSE4.2: no gathers, but the arithmetic is done two lanes at a time ---
+
+// All-ones in the lanes of v that aren't missing
+RF_SSE42 inline __m128d present2_sse42(__m128d v, __m128d nodata) {
+  return _mm_and_pd(_mm_cmpord_pd(v, v), _mm_cmpneq_pd(v, nodata));
+}
+
+template <class T>
+RF_SSE42 void bilinear_row_sse42(const T* north, const T* south, double wylo, double wyhi,
+  const axis_index_t* xlo, const axis_index_t* xhi,
+  const double* wxlo, const double* wxhi, double nodata, T na,
+  T* out, index_t n, index_t nsafe) {
+
+  const __m128d wyl = _mm_set1_pd(wylo), wyh = _mm_set1_pd(wyhi);
+  const __m128d nd = _mm_set1_pd(nodata), nav = _mm_set1_pd(static_cast<double>(na));
+  double tmp[2];
+  index_t x = 0;
+  for (; x + 2 <= n; x += 2) {
+    __m128d nw = _mm_set_pd(north[xlo[x + 1]], north[xlo[x]]);
+    __m128d ne = _mm_set_pd(north[xhi[x + 1]], north[xhi[x]]);
+    __m128d sw = _mm_set_pd(south[xlo[x + 1]], south[xlo[x]]);
+    __m128d se = _mm_set_pd(south[xhi[x + 1]], south[xhi[x]]);
+    __m128d wxl = _mm_loadu_pd(wxlo + x), wxh = _mm_loadu_pd(wxhi + x);
+    __m128d okNW = present2_sse42(nw, nd), okNE = present2_sse42(ne, nd);
+    __m128d okSW = present2_sse42(sw, nd), okSE = present2_sse42(se, nd);
+    __m128d wnw = _mm_and_pd(okNW, wxl), wne = _mm_and_pd(okNE, wxh);
+    __m128d wsw = _mm_and_pd(okSW, wxl), wse = _mm_and_pd(okSE, wxh);
+    __m128d nv = _mm_add_pd(_mm_mul_pd(_mm_and_pd(okNE, ne), wne),
+      _mm_mul_pd(_mm_and_pd(okNW, nw), wnw));
+    __m128d sv = _mm_add_pd(_mm_mul_pd(_mm_and_pd(okSE, se), wse),
+      _mm_mul_pd(_mm_and_pd(okSW, sw), wsw));
+    __m128d value = _mm_add_pd(_mm_mul_pd(sv, wyh), _mm_mul_pd(nv, wyl));
+    __m128d total = _mm_add_pd(_mm_mul_pd(_mm_add_pd(wse, wsw), wyh),
+      _mm_mul_pd(_mm_add_pd(wne, wnw), wyl));
+    __m128d renorm = _mm_blendv_pd(nav, _mm_div_pd(value, total),
+      _mm_cmpgt_pd(total, _mm_setzero_pd()));
+    __m128d all = _mm_and_pd(_mm_and_pd(okNW, okNE), _mm_and_pd(okSW, okSE));
+    _mm_storeu_pd(tmp, _mm_blendv_pd(renorm, value, all));
+    out[x] = static_cast<T>(tmp[0]);
+    out[x + 1] = static_cast<T>(tmp[1]);
+  }
+  bilinear_row_scalar(north, south, wylo, wyhi, xlo + x, xhi + x,
+    wxlo + x, wxhi + x, nodata, na, out + x, n - x, 0);
+}
+
+// --- AVX2: 8 cells per iteration, as two groups of 4 double lanes ---
+
+// Gather 4 cells and widen them to double.
+RF_AVX2 inline __m256d gather4_avx2(const double* base, __m128i idx) {
+  return _mm256_i32gather_pd(base, idx, 8);
+}
+RF_AVX2 inline __m256d gather4_avx2(const float* base, __m128i idx) {
+  return _mm256_cvtps_pd(_mm_i32gather_ps(base, idx, 4));
+}
+RF_AVX2 inline __m256d gather4_avx2(const int32_t* base, __m128i idx) {
+  return _mm256_cvtepi32_pd(_mm_i32gather_epi32(reinterpret_cast<const int*>(base), idx, 4));
+}
+RF_AVX2 inline __m256d gather4_avx2(const uint32_t* base, __m128i idx) {
+  // No unsigned conversion before AVX-512; bias into signed range and back.
+  __m128i v = _mm_i32gather_epi32(reinterpret_cast<const int*>(base), idx, 4);
+  v = _mm_xor_si128(v, _mm_set1_epi32(0x80000000));
+  return _mm256_add_pd(_mm256_cvtepi32_pd(v), _mm256_set1_pd(2147483648.0));
+}
+RF_AVX2 inline __m256d gather4_avx2(const int16_t* base, __m128i idx) {
+  __m128i v = _mm_i32gather_epi32(reinterpret_cast<const int*>(base), idx, 2);
+  return _mm256_cvtepi32_pd(_mm_srai_epi32(_mm_slli_epi32(v, 16), 16));
+}
+RF_AVX2 inline __m256d gather4_avx2(const uint16_t* base, __m128i idx) {
+  __m128i v = _mm_i32gather_epi32(reinterpret_cast<const int*>(base), idx, 2);
+  return _mm256_cvtepi32_pd(_mm_and_si128(v, _mm_set1_epi32(0xFFFF)));
+}
+RF_AVX2 inline __m256d gather4_avx2(const int8_t* base, __m128i idx) {
+  __m128i v = _mm_i32gather_epi32(reinterpret_cast<const int*>(base), idx, 1);
+  return _mm256_cvtepi32_pd(_mm_srai_epi32(_mm_slli_epi32(v, 24), 24));
+}
+RF_AVX2 inline __m256d gather4_avx2(const uint8_t* base, __m128i idx) {
+  __m128i v = _mm_i32gather_epi32(reinterpret_cast<const int*>(base), idx, 1);
+  return _mm256_cvtepi32_pd(_mm_and_si128(v, _mm_set1_epi32(0xFF)));
+}
+RF_AVX2 inline __m256d gather4_avx2(const bool* base, __m128i idx) {
+  return gather4_avx2(reinterpret_cast<const uint8_t*>(base), idx);
+}
+
+// Store 8 double lanes (a, then b) as T, with the same conversion as
+// static_cast<T>. Interpolated values always lie within the range of T, so
+// truncating to int32 and then packing with saturation is exact.
+template <class T>
+RF_AVX2 inline void store8_avx2(T* out, __m256d a, __m256d b) {
+  double tmp[8];
+  _mm256_storeu_pd(tmp, a);
+  _mm256_storeu_pd(tmp + 4, b);
+  for (int k = 0; k < 8; k++)
+    out[k] = static_cast<T>(tmp[k]);
+}
+RF_AVX2 inline void store8_avx2(double* out, __m256d a, __m256d b) {
+  _mm256_storeu_pd(out, a);
+  _mm256_storeu_pd(out + 4, b);
+}
+RF_AVX2 inline void store8_avx2(float* out, __m256d a, __m256d b) {
+  _mm_storeu_ps(out, _mm256_cvtpd_ps(a));
+  _mm_storeu_ps(out + 4, _mm256_cvtpd_ps(b));
+}
+RF_AVX2 inline void store8_avx2(int32_t* out, __m256d a, __m256d b) {
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm256_cvttpd_epi32(a));
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 4), _mm256_cvttpd_epi32(b));
+}
+RF_AVX2 inline void store8_avx2(uint16_t* out, __m256d a, __m256d b) {
+  __m128i v = _mm_packus_epi32(_mm256_cvttpd_epi32(a), _mm256_cvttpd_epi32(b));
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(out), v);
+}
+RF_AVX2 inline void store8_avx2(int16_t* out, __m256d a, __m256d b) {
+  __m128i v = _mm_packs_epi32(_mm256_cvttpd_epi32(a), _mm256_cvttpd_epi32(b));
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(out), v);
+}
+RF_AVX2 inline void store8_avx2(uint8_t* out, __m256d a, __m256d b) {
+  __m128i v = _mm_packs_epi32(_mm256_cvttpd_epi32(a), _mm256_cvttpd_epi32(b));
+  _mm_storel_epi64(reinterpret_cast<__m128i*>(out), _mm_packus_epi16(v, v));
+}
+RF_AVX2 inline void store8_avx2(int8_t* out, __m256d a, __m256d b) {
+  __m128i v = _mm_packs_epi32(_mm256_cvttpd_epi32(a), _mm256_cvttpd_epi32(b));
+  _mm_storel_epi64(reinterpret_cast<__m128i*>(out), _mm_packs_epi16(v, v));
+}
+
+// All-ones in the lanes of v that aren't missing
+RF_AVX2 inline __m256d present4_avx2(__m256d v, __m256d nodata) {
+  return _mm256_and_pd(_mm256_cmp_pd(v, v, _CMP_ORD_Q),
+    _mm256_cmp_pd(v, nodata, _CMP_NEQ_UQ));
+}
+
+template <class T>
+RF_AVX2 inline __m256d bilinear4_avx2(const T* north, const T* south,
+  __m256d wyl, __m256d wyh, __m256d nodata, __m256d na,
+  const axis_index_t* xlo, const axis_index_t* xhi,
+  const double* wxlo, const double* wxhi) {
+
+  __m128i ilo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(xlo));
+  __m128i ihi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(xhi));
+  __m256d wxl = _mm256_loadu_pd(wxlo), wxh = _mm256_loadu_pd(wxhi);
+  __m256d nw = gather4_avx2(north, ilo), ne = gather4_avx2(north, ihi);
+  __m256d sw = gather4_avx2(south, ilo), se = gather4_avx2(south, ihi);
+  __m256d okNW = present4_avx2(nw, nodata), okNE = present4_avx2(ne, nodata);
+  __m256d okSW = present4_avx2(sw, nodata), okSE = present4_avx2(se, nodata);
+  __m256d wnw = _mm256_and_pd(okNW, wxl), wne = _mm256_and_pd(okNE, wxh);
+  __m256d wsw = _mm256_and_pd(okSW, wxl), wse = _mm256_and_pd(okSE, wxh);
+  __m256d nv = _mm256_add_pd(_mm256_mul_pd(_mm256_and_pd(okNE, ne), wne),
+    _mm256_mul_pd(_mm256_and_pd(okNW, nw), wnw));
+  __m256d sv = _mm256_add_pd(_mm256_mul_pd(_mm256_and_pd(okSE, se), wse),
+    _mm256_mul_pd(_mm256_and_pd(okSW, sw), wsw));
+  __m256d value = _mm256_add_pd(_mm256_mul_pd(sv, wyh), _mm256_mul_pd(nv, wyl));
+  __m256d total = _mm256_add_pd(_mm256_mul_pd(_mm256_add_pd(wse, wsw), wyh),
+    _mm256_mul_pd(_mm256_add_pd(wne, wnw), wyl));
+  __m256d renorm = _mm256_blendv_pd(na, _mm256_div_pd(value, total),
+    _mm256_cmp_pd(total, _mm256_setzero_pd(), _CMP_GT_OQ));
+  __m256d all = _mm256_and_pd(_mm256_and_pd(okNW, okNE), _mm256_and_pd(okSW, okSE));
+  return _mm256_blendv_pd(renorm, value, all);
+}
+
+template <class T>
+RF_AVX2 void bilinear_row_avx2(const T* north, const T* south, double wylo, double wyhi,
+  const axis_index_t* xlo, const axis_index_t* xhi,
+  const double* wxlo, const double* wxhi, double nodata, T na,
+  T* out, index_t n, index_t nsafe) {
+
+  const __m256d wyl = _mm256_set1_pd(wylo), wyh = _mm256_set1_pd(wyhi);
+  const __m256d nd = _mm256_set1_pd(nodata), nav = _mm256_set1_pd(static_cast<double>(na));
+  index_t x = 0;
+  for (; x + 8 <= nsafe; x += 8) {
+    __m256d a = bilinear4_avx2(north, south, wyl, wyh, nd, nav,
+      xlo + x, xhi + x, wxlo + x, wxhi + x);
+    __m256d b = bilinear4_avx2(north, south, wyl, wyh, nd, nav,
+      xlo + x + 4, xhi + x + 4, wxlo + x + 4, wxhi + x + 4);
+    store8_avx2(out + x, a, b);
+  }
+  bilinear_row_scalar(north, south, wylo, wyhi, xlo + x, xhi + x,
+    wxlo + x, wxhi + x, nodata, na, out + x, n - x, 0);
+}
+
+// Nearest neighbor is a pure gather, so it works on the raw bits of each
+// cell; only the width of T matters.
+template <class T>
+RF_AVX2 void nearest_row_avx2(const T* src, const axis_index_t* xs,
+  T* out, index_t n, index_t nsafe) {
+
+  index_t x = 0;
+  for (; x + 8 <= nsafe; x += 8) {
+    __m256i idx = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(xs + x));
+    if (sizeof(T) == 8) {
+      const long long* base = reinterpret_cast<const long long*>(src);
+      __m256i a = _mm256_i32gather_epi64(base, _mm256_castsi256_si128(idx), 8);
+      __m256i b = _mm256_i32gather_epi64(base, _mm256_extracti128_si256(idx, 1), 8);
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + x), a);
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + x + 4), b);
+    } else if (sizeof(T) == 4) {
+      __m256i v = _mm256_i32gather_epi32(reinterpret_cast<const int*>(src), idx, 4);
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + x), v);
+    } else if (sizeof(T) == 2) {
+      __m256i v = _mm256_i32gather_epi32(reinterpret_cast<const int*>(src), idx, 2);
+      // Keep the low 2 bytes of each lane, then join the two 128-bit halves.
+      v = _mm256_shuffle_epi8(v, _mm256_setr_epi8(
+        0, 1, 4, 5, 8, 9, 12, 13, -1, -1, -1, -1, -1, -1, -1, -1,
+        0, 1, 4, 5, 8, 9, 12, 13, -1, -1, -1, -1, -1, -1, -1, -1));
+      v = _mm256_permute4x64_epi64(v, 0x08);
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x), _mm256_castsi256_si128(v));
+    } else {
+      __m256i v = _mm256_i32gather_epi32(reinterpret_cast<const int*>(src), idx, 1);
+      // Keep the low byte of each lane, then join the two 128-bit halves.
+      v = _mm256_shuffle_epi8(v, _mm256_setr_epi8(
+        0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1));
+      v = _mm256_permutevar8x32_epi32(v, _mm256_setr_epi32(0, 4, 0, 0, 0, 0, 0, 0));
+      _mm_storel_epi64(reinterpret_cast<__m128i*>(out + x), _mm256_castsi256_si128(v));
+    }
+  }
+  nearest_row_scalar(src, xs + x, out + x, n - x, 0);
+}
+
+// --- AVX-512: 16 cells per iteration, as two groups of 8 double lanes ---
+
+RF_AVX512 inline __m512d gather8_avx512(const double* base, __m256i idx) {
+  return _mm512_i32gather_pd(idx, base, 8);
+}
+RF_AVX512 inline __m512d gather8_avx512(const float* base, __m256i idx) {
+  return _mm512_cvtps_pd(_mm256_i32gather_ps(base, idx, 4));
+}
+RF_AVX512 inline __m512d gather8_avx512(const int32_t* base, __m256i idx) {
+  return _mm512_cvtepi32_pd(_mm256_i32gather_epi32(reinterpret_cast<const int*>(base), idx, 4));
+}
+RF_AVX512 inline __m512d gather8_avx512(const uint32_t* base, __m256i idx) {
+  return _mm512_cvtepu32_pd(_mm256_i32gather_epi32(reinterpret_cast<const int*>(base), idx, 4));
+}
+RF_AVX512 inline __m512d gather8_avx512(const int16_t* base, __m256i idx) {
+  __m256i v = _mm256_i32gather_epi32(reinterpret_cast<const int*>(base), idx, 2);
+  return _mm512_cvtepi32_pd(_mm256_srai_epi32(_mm256_slli_epi32(v, 16), 16));
+}
+RF_AVX512 inline __m512d gather8_avx512(const uint16_t* base, __m256i idx) {
+  __m256i v = _mm256_i32gather_epi32(reinterpret_cast<const int*>(base), idx, 2);
+  return _mm512_cvtepi32_pd(_mm256_and_si256(v, _mm256_set1_epi32(0xFFFF)));
+}
+RF_AVX512 inline __m512d gather8_avx512(const int8_t* base, __m256i idx) {
+  __m256i v = _mm256_i32gather_epi32(reinterpret_cast<const int*>(base), idx, 1);
+  return _mm512_cvtepi32_pd(_mm256_srai_epi32(_mm256_slli_epi32(v, 24), 24));
+}
+RF_AVX512 inline __m512d gather8_avx512(const uint8_t* base, __m256i idx) {
+  __m256i v = _mm256_i32gather_epi32(reinterpret_cast<const int*>(base), idx, 1);
+  return _mm512_cvtepi32_pd(_mm256_and_si256(v, _mm256_set1_epi32(0xFF)));
+}
+RF_AVX512 inline __m512d gather8_avx512(const bool* base, __m256i idx) {
+  return gather8_avx512(reinterpret_cast<const uint8_t*>(base), idx);
+}
+
+// Store 16 double lanes (a, then b) as T; see store8_avx2.
+template <class T>
+RF_AVX512 inline void store16_avx512(T* out, __m512d a, __m512d b) {
+  double tmp[16];
+  _mm512_storeu_pd(tmp, a);
+  _mm512_storeu_pd(tmp + 8, b);
+  for (int k = 0; k < 16; k++)
+    out[k] = static_cast<T>(tmp[k]);
+}
+RF_AVX512 inline void store16_avx512(double* out, __m512d a, __m512d b) {
+  _mm512_storeu_pd(out, a);
+  _mm512_storeu_pd(out + 8, b);
+}
+RF_AVX512 inline void store16_avx512(float* out, __m512d a, __m512d b) {
+  _mm256_storeu_ps(out, _mm512_cvtpd_ps(a));
+  _mm256_storeu_ps(out + 8, _mm512_cvtpd_ps(b));
+}
+RF_AVX512 inline void store16_avx512(int32_t* out, __m512d a, __m512d b) {
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), _mm512_cvttpd_epi32(a));
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 8), _mm512_cvttpd_epi32(b));
+}
+RF_AVX512 inline void store16_avx512(uint32_t* out, __m512d a, __m512d b) {
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), _mm512_cvttpd_epu32(a));
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 8), _mm512_cvttpd_epu32(b));
+}
+// Truncate all 16 lanes to int32, for narrowing with _mm512_cvtepi32_epi*.
+RF_AVX512 inline __m512i cvtt16_avx512(__m512d a, __m512d b) {
+  return _mm512_inserti64x4(_mm512_castsi256_si512(_mm512_cvttpd_epi32(a)),
+    _mm512_cvttpd_epi32(b), 1);
+}
+RF_AVX512 inline void store16_avx512(uint16_t* out, __m512d a, __m512d b) {
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), _mm512_cvtepi32_epi16(cvtt16_avx512(a, b)));
+}
+RF_AVX512 inline void store16_avx512(int16_t* out, __m512d a, __m512d b) {
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), _mm512_cvtepi32_epi16(cvtt16_avx512(a, b)));
+}
+RF_AVX512 inline void store16_avx512(uint8_t* out, __m512d a, __m512d b) {
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm512_cvtepi32_epi8(cvtt16_avx512(a, b)));
+}
+RF_AVX512 inline void store16_avx512(int8_t* out, __m512d a, __m512d b) {
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm512_cvtepi32_epi8(cvtt16_avx512(a, b)));
+}
+
+// The lanes of v that aren't missing
+RF_AVX512 inline __mmask8 present8_avx512(__m512d v, __m512d nodata) {
+  return _mm512_mask_cmp_pd_mask(_mm512_cmp_pd_mask(v, v, _CMP_ORD_Q),
+    v, nodata, _CMP_NEQ_UQ);
+}
+
+// As bilinear4_avx2, with mask registers; the renormalized value is only
+// divided out in the lanes that need it.
+template <class T>
+RF_AVX512 inline __m512d bilinear8_avx512(const T* north, const T* south,
+  __m512d wyl, __m512d wyh, __m512d nodata, __m512d na,
+  const axis_index_t* xlo, const axis_index_t* xhi,
+  const double* wxlo, const double* wxhi) {
+
+  __m256i ilo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(xlo));
+  __m256i ihi = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(xhi));
+  __m512d wxl = _mm512_loadu_pd(wxlo), wxh = _mm512_loadu_pd(wxhi);
+  __m512d nw = gather8_avx512(north, ilo), ne = gather8_avx512(north, ihi);
+  __m512d sw = gather8_avx512(south, ilo), se = gather8_avx512(south, ihi);
+  __mmask8 okNW = present8_avx512(nw, nodata), okNE = present8_avx512(ne, nodata);
+  __mmask8 okSW = present8_avx512(sw, nodata), okSE = present8_avx512(se, nodata);
+  __m512d wnw = _mm512_maskz_mov_pd(okNW, wxl), wne = _mm512_maskz_mov_pd(okNE, wxh);
+  __m512d wsw = _mm512_maskz_mov_pd(okSW, wxl), wse = _mm512_maskz_mov_pd(okSE, wxh);
+  __m512d nv = _mm512_add_pd(_mm512_mul_pd(_mm512_maskz_mov_pd(okNE, ne), wne),
+    _mm512_mul_pd(_mm512_maskz_mov_pd(okNW, nw), wnw));
+  __m512d sv = _mm512_add_pd(_mm512_mul_pd(_mm512_maskz_mov_pd(okSE, se), wse),
+    _mm512_mul_pd(_mm512_maskz_mov_pd(okSW, sw), wsw));
+  __m512d value = _mm512_add_pd(_mm512_mul_pd(sv, wyh), _mm512_mul_pd(nv, wyl));
+  __m512d total = _mm512_add_pd(_mm512_mul_pd(_mm512_add_pd(wse, wsw), wyh),
+    _mm512_mul_pd(_mm512_add_pd(wne, wnw), wyl));
+  __mmask8 some = static_cast<__mmask8>(~(okNW & okNE & okSW & okSE));
+  __mmask8 divide = _mm512_mask_cmp_pd_mask(some, total, _mm512_setzero_pd(), _CMP_GT_OQ);
+  __m512d result = _mm512_mask_mov_pd(value, some, na);
+  return _mm512_mask_div_pd(result, divide, value, total);
+}
+
+template <class T>
+RF_AVX512 void bilinear_row_avx512(const T* north, const T* south, double wylo, double wyhi,
+  const axis_index_t* xlo, const axis_index_t* xhi,
+  const double* wxlo, const double* wxhi, double nodata, T na,
+  T* out, index_t n, index_t nsafe) {
+
+  const __m512d wyl = _mm512_set1_pd(wylo), wyh = _mm512_set1_pd(wyhi);
+  const __m512d nd = _mm512_set1_pd(nodata), nav = _mm512_set1_pd(static_cast<double>(na));
+  index_t x = 0;
+  for (; x + 16 <= nsafe; x += 16) {
+    __m512d a = bilinear8_avx512(north, south, wyl, wyh, nd, nav,
+      xlo + x, xhi + x, wxlo + x, wxhi + x);
+    __m512d b = bilinear8_avx512(north, south, wyl, wyh, nd, nav,
+      xlo + x + 8, xhi + x + 8, wxlo + x + 8, wxhi + x + 8);
+    store16_avx512(out + x, a, b);
+  }
+  bilinear_row_scalar(north, south, wylo, wyhi, xlo + x, xhi + x,
+    wxlo + x, wxhi + x, nodata, na, out + x, n - x, 0);
+}
+
+template <class T>
+RF_AVX512 void nearest_row_avx512(const T* src, const axis_index_t* xs,
+  T* out, index_t n, index_t nsafe) {
+
+  index_t x = 0;
+  for (; x + 16 <= nsafe; x += 16) {
+    __m512i idx = _mm512_loadu_si512(xs + x);
+    if (sizeof(T) == 8) {
+      const long long* base = reinterpret_cast<const long long*>(src);
+      __m512i a = _mm512_i32gather_epi64(_mm512_castsi512_si256(idx), base, 8);
+      __m512i b = _mm512_i32gather_epi64(_mm512_extracti64x4_epi64(idx, 1), base, 8);
+      _mm512_storeu_si512(out + x, a);
+      _mm512_storeu_si512(out + x + 8, b);
+    } else if (sizeof(T) == 4) {
+      _mm512_storeu_si512(out + x, _mm512_i32gather_epi32(idx, src, 4));
+    } else if (sizeof(T) == 2) {
+      __m512i v = _mm512_i32gather_epi32(idx, src, 2);
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + x), _mm512_cvtepi32_epi16(v));
+    } else {
+      __m512i v = _mm512_i32gather_epi32(idx, src, 1);
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x), _mm512_cvtepi32_epi8(v));
+    }
+  }
+  nearest_row_scalar(src, xs + x, out + x, n - x, 0);
+}
+
+#endif // RASTERFASTER_X86_SIMD
+
+template <class T>
+typename BilinearRowKernel<T>::type bilinearRowKernel(SimdLevel level) {
+#ifdef RASTERFASTER_X86_SIMD
+  switch (level) {
+  case SIMD_AVX512: return &bilinear_row_avx512<T>;
+  case SIMD_AVX2: return &bilinear_row_avx2<T>;
+  case SIMD_SSE42:
+    // Without gathers, converting integer cells in and out of double lanes
+    // costs more than the arithmetic saves.
+    if (!std::numeric_limits<T>::is_integer)
+      return &bilinear_row_sse42<T>;
+    break;
+  default: break;
+  }
+#endif
+  return &bilinear_row_scalar<T>;
+}
+
+template <class T>
+typename NearestRowKernel<T>::type nearestRowKernel(SimdLevel level) {
+#ifdef RASTERFASTER_X86_SIMD
+  // SSE4.2 has no gather instruction, so it's no better than scalar here.
+  switch (level) {
+  case SIMD_AVX512: return &nearest_row_avx512<T>;
+  case SIMD_AVX2: return &nearest_row_avx2<T>;
+  default: break;
+  }
+#endif
+  return &nearest_row_scalar<T>;
+}
+
+#endif
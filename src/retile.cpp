@@ -0,0 +1,119 @@
+#include <Rcpp.h>
+// [[Rcpp::depends(RcppParallel)]]
+#include <RcppParallel.h>
+
+#include <algorithm>
+#include <fstream>
+
+#include <boost/cstdint.hpp>
+
+#include "grid.hpp"
+#include "mmfile.hpp"
+#include "raster_source.hpp"
+
+using namespace Rcpp;
+
+// Copies a row-major source into a tiled copy (see Tiled). Work is handed out
+// in rows of tiles, which are read from whole rows of the source and written
+// to one run of the copy. Each row of a tile holds the same cells, in the
+// same order, as the part of the source row that it covers, so cells are
+// copied in runs of a tile's width (of every band, if they're interleaved).
+// T only needs to be the size of a cell: cells are copied as they are, in
+// whatever byte order the file has.
+template <class T>
+class RetileWorker : public RcppParallel::Worker {
+  const Grid<T>* pSrc;
+  const Grid<T, Tiled>* pTgt;
+
+public:
+  RetileWorker(const Grid<T>* pSrc, const Grid<T, Tiled>* pTgt) :
+    pSrc(pSrc), pTgt(pTgt) {
+  }
+
+  // begin and end are numbers of rows of tiles
+  void operator()(size_t begin, size_t end) {
+    index_t bands = pSrc->nband();
+    // With BIP, a run of cells holds every band; otherwise each band's run
+    // is copied on its own
+    bool together = bands == 1 || pSrc->colStep() != 1;
+    index_t row1 = std::min(end * TILE_SIZE, pSrc->nrow());
+
+    for (index_t row = begin * TILE_SIZE; row < row1; row++) {
+      for (index_t col = 0; col < pSrc->ncol(); col += TILE_SIZE) {
+        index_t n = std::min(TILE_SIZE, pSrc->ncol() - col);
+        for (index_t b = 0; b < (together ? 1 : bands); b++) {
+          const T* from = pSrc->at(row, col, b);
+          std::copy(from, from + (together ? n * bands : n), pTgt->at(row, col, b));
+        }
+      }
+    }
+  }
+};
+
+template <class T>
+void retile(const std::string& from, index_t stride, index_t rows,
+  index_t cols, index_t bands, BandOrder order, const std::string& to) {
+
+  MMFile<T> from_f(from, boost::interprocess::read_only, MM_ACCESS_SEQUENTIAL);
+  if (static_cast<index_t>(from_f.end() - from_f.begin()) < RowMajor::cells(stride, rows, bands)) {
+    Rcpp::stop("File %s is too small for its raster", from);
+  }
+  Grid<T> from_g(from_f.begin(), from_f.begin() + RowMajor::cells(stride, rows, bands),
+    stride, rows, cols, bands, order);
+
+  // The copy is created at its full size, padding included; the padding is
+  // never read, so it's left as zeros.
+  index_t cells = Tiled::cells(stride, rows, bands);
+  {
+    std::filebuf f;
+    if (!f.open(to.c_str(), std::ios::out | std::ios::binary | std::ios::trunc) ||
+      f.pubseekoff(cells * sizeof(T) - 1, std::ios::beg) == std::streampos(-1) ||
+      f.sputc(0) == std::filebuf::traits_type::eof() || !f.close()) {
+      Rcpp::stop("Cannot write file %s", to);
+    }
+  }
+  MMFile<T> to_f(to, boost::interprocess::read_write, MM_ACCESS_SEQUENTIAL);
+  Grid<T, Tiled> to_g(to_f.begin(), to_f.end(), stride, rows, cols, bands, order);
+
+  RetileWorker<T> worker(&from_g, &to_g);
+  RcppParallel::parallelFor(0, (rows + TILE_SIZE - 1) / TILE_SIZE, worker, 1);
+  to_f.flush();
+}
+
+// Writes a tiled copy (see Tiled) of the row-major raster file from, with
+// the given layout and dataFormat, to the file to, which is created or
+// overwritten. The copy keeps the source's byte order. Projection reads the
+// copy instead of the source when it's passed with tiled set (see
+// do_project_tiles).
+// [[Rcpp::export]]
+void retile_file(const std::string& from, int fromStride, int fromRows, int fromCols,
+    int bands, const std::string& bandOrder, const std::string& dataFormat,
+    const std::string& to) {
+  if (fromRows <= 0 || fromCols <= 0 || fromStride < fromCols) {
+    stop("Invalid raster dimensions");
+  }
+  if (bands <= 0) {
+    stop("bands must be positive");
+  }
+  BandOrder order;
+  if (!parseBandOrder(bandOrder, &order)) {
+    stop("Unknown band order: %s", bandOrder);
+  }
+
+  switch (dataFormatSize(dataFormat)) {
+  case 1:
+    retile<boost::uint8_t>(from, fromStride, fromRows, fromCols, bands, order, to);
+    break;
+  case 2:
+    retile<boost::uint16_t>(from, fromStride, fromRows, fromCols, bands, order, to);
+    break;
+  case 4:
+    retile<boost::uint32_t>(from, fromStride, fromRows, fromCols, bands, order, to);
+    break;
+  case 8:
+    retile<boost::uint64_t>(from, fromStride, fromRows, fromCols, bands, order, to);
+    break;
+  default:
+    stop("Unknown data format: %s", dataFormat);
+  }
+}
@@ -0,0 +1,64 @@
+#ifndef SIMD_HPP
+#define SIMD_HPP
+
+#include <string>
+
+// Vectorized kernels are compiled with per-function target attributes and
+// chosen at runtime, so the package itself can be built for the baseline
+// architecture. Only GCC-compatible compilers on x86 get them; everything
+// else uses the scalar kernels.
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define RASTERFASTER_X86_SIMD 1
+#define RF_SSE42 __attribute__((target("sse4.2")))
+#define RF_AVX2 __attribute__((target("avx2")))
+#define RF_AVX512 __attribute__((target("avx512f")))
+#endif
+
+enum SimdLevel {
+  SIMD_SCALAR = 0,
+  SIMD_SSE42 = 1,
+  SIMD_AVX2 = 2,
+  SIMD_AVX512 = 3
+};
+
+// The best instruction set supported by both the CPU and the OS.
+inline SimdLevel detectSimdLevel() {
+#ifdef RASTERFASTER_X86_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f"))
+    return SIMD_AVX512;
+  if (__builtin_cpu_supports("avx2"))
+    return SIMD_AVX2;
+  if (__builtin_cpu_supports("sse4.2"))
+    return SIMD_SSE42;
+#endif
+  return SIMD_SCALAR;
+}
+
+// The instruction set the kernels should use. Defaults to the detected
+// level, but can be lowered (e.g. to compare kernels against each other).
+inline SimdLevel& simdLevel() {
+  static SimdLevel level = detectSimdLevel();
+  return level;
+}
+
+inline const char* simdLevelName(SimdLevel level) {
+  switch (level) {
+  case SIMD_AVX512: return "avx512";
+  case SIMD_AVX2: return "avx2";
+  case SIMD_SSE42: return "sse4.2";
+  default: return "scalar";
+  }
+}
+
+// Parses a level name; returns false if the name is unknown.
+inline bool parseSimdLevel(const std::string& name, SimdLevel* level) {
+  if (name == "avx512") *level = SIMD_AVX512;
+  else if (name == "avx2") *level = SIMD_AVX2;
+  else if (name == "sse4.2") *level = SIMD_SSE42;
+  else if (name == "scalar") *level = SIMD_SCALAR;
+  else return false;
+  return true;
+}
+
+#endif
@@ -0,0 +1,154 @@
+#ifndef TILE_CACHE_HPP
+#define TILE_CACHE_HPP
+
+#include <iomanip>
+#include <list>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+#include <RcppParallel.h>
+
+// The default memory budget of the tile cache: 256 tiles of 256x256 FLT4S.
+const size_t DEFAULT_TILE_CACHE_BYTES = 64 * 1024 * 1024;
+
+// TileCache keeps the contents of recently rendered tiles, so that popular
+// tiles can be copied out instead of being projected again. Keys are opaque
+// strings that must identify everything the tile's contents depend on (see
+// fileIdentity). The least recently used tiles are evicted once the cache
+// holds more than its budget. All methods may be called from any thread.
+class TileCache {
+public:
+  typedef boost::shared_ptr<const std::vector<char> > data_ptr;
+
+  struct Stats {
+    double hits, misses, evictions;
+    double entries, bytes, budget;
+  };
+
+private:
+  typedef std::list<std::pair<std::string, data_ptr> > entry_list;
+
+  // Most recently used first
+  entry_list _entries;
+  std::map<std::string, entry_list::iterator> _index;
+  size_t _bytes, _budget;
+  double _hits, _misses, _evictions;
+  mutable tthread::mutex _mutex;
+
+  // Must be called with _mutex held
+  void evict() {
+    while (_bytes > _budget && !_entries.empty()) {
+      _bytes -= _entries.back().second->size();
+      _index.erase(_entries.back().first);
+      _entries.pop_back();
+      _evictions++;
+    }
+  }
+
+public:
+  explicit TileCache(size_t budget = DEFAULT_TILE_CACHE_BYTES) :
+    _bytes(0), _budget(budget), _hits(0), _misses(0), _evictions(0) {
+  }
+
+  // Looks up a tile, and marks it as most recently used. Returns false (and
+  // counts a miss) if it isn't cached.
+  bool get(const std::string& key, data_ptr* pData) {
+    tthread::lock_guard<tthread::mutex> lock(_mutex);
+    std::map<std::string, entry_list::iterator>::iterator it = _index.find(key);
+    if (it == _index.end()) {
+      _misses++;
+      return false;
+    }
+    _entries.splice(_entries.begin(), _entries, it->second);
+    *pData = it->second->second;
+    _hits++;
+    return true;
+  }
+
+  // Adds or replaces a tile. Tiles larger than the whole budget are not
+  // cached.
+  void put(const std::string& key, const data_ptr& data) {
+    tthread::lock_guard<tthread::mutex> lock(_mutex);
+    if (data->size() > _budget) {
+      return;
+    }
+    std::map<std::string, entry_list::iterator>::iterator it = _index.find(key);
+    if (it != _index.end()) {
+      _bytes -= it->second->second->size();
+      _entries.erase(it->second);
+      _index.erase(it);
+    }
+    _entries.push_front(std::make_pair(key, data));
+    _index[key] = _entries.begin();
+    _bytes += data->size();
+    evict();
+  }
+
+  // Sets the budget, evicting as necessary; a budget of 0 disables caching.
+  void setBudget(size_t budget) {
+    tthread::lock_guard<tthread::mutex> lock(_mutex);
+    _budget = budget;
+    evict();
+  }
+
+  bool enabled() const {
+    tthread::lock_guard<tthread::mutex> lock(_mutex);
+    return _budget > 0;
+  }
+
+  Stats stats() const {
+    tthread::lock_guard<tthread::mutex> lock(_mutex);
+    Stats s;
+    s.hits = _hits;
+    s.misses = _misses;
+    s.evictions = _evictions;
+    s.entries = _entries.size();
+    s.bytes = _bytes;
+    s.budget = _budget;
+    return s;
+  }
+};
+
+// The process-wide tile cache.
+inline TileCache& tileCache() {
+  static TileCache cache;
+  return cache;
+}
+
+// The sub-second part of a file's modification time, where the platform
+// records one; otherwise 0.
+inline long fileMtimeNsec(const struct stat& st) {
+#if defined(__APPLE__)
+  return st.st_mtimespec.tv_nsec;
+#elif defined(_WIN32)
+  (void)st;
+  return 0;
+#else
+  return st.st_mtim.tv_nsec;
+#endif
+}
+
+// Identifies the current contents of a file by its path, device, inode, size
+// and modification time (to the nanosecond where available), so cached tiles
+// are not served after the source is rewritten or replaced. Returns an empty
+// string if the file can't be examined.
+inline std::string fileIdentity(const std::string& path) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) {
+    return std::string();
+  }
+  std::ostringstream id;
+  id << path << '\n' << static_cast<boost::uintmax_t>(st.st_dev)
+     << '\n' << static_cast<boost::uintmax_t>(st.st_ino)
+     << '\n' << static_cast<boost::intmax_t>(st.st_size)
+     << '\n' << static_cast<boost::intmax_t>(st.st_mtime)
+     << '.' << std::setw(9) << std::setfill('0') << fileMtimeNsec(st);
+  return id.str();
+}
+
+#endif